@@ -0,0 +1,106 @@
+//
+//  agent-reader.cpp
+//  drspin
+//
+
+#include "agent-reader.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+AgentReader::AgentReader(const pid_t pid)
+: _pid(pid), _samples(0), _last_timestamp(0) {
+    const std::string name = agent_ring_name(pid);
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+
+    if (fd == -1) {
+        fprintf(stderr, "drspin: no agent in process %d (%s: %s); start it with LD_PRELOAD=libdrspin-agent.so\n", pid, name.c_str(), strerror(errno));
+        exit(1);
+    }
+
+    struct stat st;
+    const int rv = fstat(fd, &st);
+    assert(!rv);
+
+    _size = st.st_size;
+    void *const memory = (_size >= sizeof (AgentRing)) ? mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    _ring = (memory != MAP_FAILED) ? (AgentRing *)memory : nullptr;
+
+    _slot_count = _ring ? _ring->slot_count : 0;
+    _rate = _ring ? _ring->rate : 0;
+
+    if (_ring == nullptr || _ring->magic != AgentRing::magic_value || _ring->pid != (uint32_t)pid || !AgentRing::valid_slot_count(_slot_count) || _size < AgentRing::size(_slot_count) || !(_rate > 0 && _rate <= 1e9)) {
+        fprintf(stderr, "drspin: %s isn't a ring this version of drspin can read\n", name.c_str());
+        exit(1);
+    }
+
+    // Throw away anything left over from an earlier reader.
+    while (_ring->pop(_sample, _slot_count)) { }
+
+    _initial_dropped = _ring->dropped.load(std::memory_order_relaxed);
+    _cpu_interval = (uint64_t)(1e9 / _rate);
+    _ring->reading.store(1, std::memory_order_relaxed);
+}
+
+AgentReader::~AgentReader() {
+    _ring->reading.store(0, std::memory_order_relaxed);
+
+    const int rv = munmap(_ring, _size);
+    assert(!rv);
+}
+
+bool AgentReader::target_exited() const {
+    if (kill(_pid, 0) == 0 || errno != ESRCH) return false;
+
+    shm_unlink(agent_ring_name(_pid).c_str());
+    return true;
+}
+
+double AgentReader::rate() const {
+    return _rate;
+}
+
+size_t AgentReader::drain(Process &process, CaptureWriter *const capture) {
+    size_t count = 0;
+
+    while (_ring->pop(_sample, _slot_count)) {
+        _stack.assign(_sample.frames, _sample.frames + _sample.depth);
+
+        // No rounds: the agent samples each thread on its own CPU clock, so an idle thread may go unsampled for any length of time without having exited.
+        // Every sample is a tick of the thread's CPU clock, so it's on a CPU and has used one interval of CPU time.
+        // Threads push in the order they finish unwinding, which may not be quite the order they took their timestamps in, but a capture's timestamps can't go backward.
+        _last_timestamp = std::max(_last_timestamp, _sample.timestamp);
+
+        Thread &thread = process.thread(_sample.lwpid);
+        const StackTrie::NodeID stack = process.add_sample(thread, _stack, _last_timestamp, true, _cpu_interval);
+
+        if (capture) {
+            capture->add_sample(process.stacks(), _sample.lwpid, _last_timestamp, stack, true, _cpu_interval);
+        }
+
+        count++;
+    }
+
+    _samples += count;
+    return count;
+}
+
+void AgentReader::print_statistics() const {
+    const uint64_t dropped = _ring->dropped.load(std::memory_order_relaxed) - _initial_dropped;
+
+    printf("  Agent rate:     %g Hz (each thread's CPU clock)\n", _rate);
+    printf("  Samples read:   %llu\n", (unsigned long long)_samples);
+    printf("  Dropped:        %llu (ring full)\n", (unsigned long long)dropped);
+    printf("\n");
+}
@@ -0,0 +1,54 @@
+//
+//  agent-reader.h
+//  drspin
+//
+
+#include "agent-ring.h"
+#include "capture.h"
+#include "process.h"
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef AGENT_READER_H
+#define AGENT_READER_H
+
+// Reads samples from the agent (see agent.cpp) in a target started with LD_PRELOAD=libdrspin-agent.so, rather than stopping the target to take them.
+struct AgentReader : private DeleteImplicit {
+    // Maps the agent's ring and tells it to start sampling.  Exits with an error if the target has no agent.
+    AgentReader(pid_t pid);
+
+    // Tells the agent to stop sampling.
+    ~AgentReader();
+
+    // The agent's rate, in samples per second of each thread's CPU time.
+    double rate() const;
+
+    // Moves every sample in the ring into `process`, recording each to `capture` if it isn't null.  Returns the number of samples read.
+    size_t drain(Process &process, CaptureWriter *capture);
+
+    // Returns true if the target has exited, having removed its ring: the agent only removes the ring itself on a normal exit, so a killed target would leave it behind.
+    bool target_exited() const;
+
+    // Prints how many samples were read and how many the agent had to drop.
+    void print_statistics() const;
+private:
+    pid_t _pid;
+    AgentRing *_ring;
+    size_t _size;
+
+    // Copied out of the ring's header (and checked) once, since the target can write the header.
+    uint32_t _slot_count;
+    double _rate;
+
+    uint64_t _initial_dropped;
+    uint64_t _samples;
+    uint64_t _last_timestamp;
+    uint64_t _cpu_interval; // in nanoseconds
+    AgentRing::Sample _sample;
+    std::vector<uintptr_t> _stack;
+};
+
+#endif /* AGENT_READER_H */
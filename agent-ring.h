@@ -0,0 +1,145 @@
+//
+//  agent-ring.h
+//  drspin
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <sys/types.h>
+
+#ifndef AGENT_RING_H
+#define AGENT_RING_H
+
+// The shared memory through which the in-process agent (libdrspin-agent.so, see agent.cpp) hands samples to `drspin --agent`.  The agent creates it, as the POSIX shared memory object named by agent_ring_name(), when it's loaded.
+//
+// It's a bounded multi-producer, single-consumer queue of fixed-size slots (after Dmitry Vyukov's bounded MPMC queue).  Producers are the target's signal handlers, so pushing must be lock-free and async-signal-safe: a producer claims a slot by advancing `head`, fills it in, and then publishes it by setting its sequence number.  If the ring is full, the sample is dropped (and counted) rather than waiting for drspin.
+//
+// Both sides must agree on the layout, so it's checked by `magic`, which includes the layout version.
+struct AgentRing {
+    static constexpr uint64_t magic_value = 0x3130676e69727364; // "dsring01"
+    static constexpr size_t max_depth = 125;
+    static constexpr uint32_t default_slot_count = 4096;
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        uint64_t timestamp; // CLOCK_MONOTONIC nanoseconds, the same clock as monotonic_time()
+        uint32_t lwpid;
+        uint32_t depth;
+        uintptr_t frames[max_depth]; // leaf first, as the unwinders produce them
+    };
+
+    static_assert(sizeof (Slot) == 1024, "slots should fill whole cache lines");
+
+    struct Sample {
+        uint64_t timestamp;
+        uint32_t lwpid;
+        uint32_t depth;
+        uintptr_t frames[max_depth];
+    };
+
+    uint64_t magic;
+    uint32_t slot_count; // a power of two (the consumer keeps its own copy; see pop())
+    uint32_t pid;
+    double rate; // samples per second of each thread's CPU time
+
+    // Set by drspin while it's reading.  The agent doesn't bother unwinding when nobody is.
+    std::atomic<uint32_t> reading;
+
+    // Samples dropped because the ring was full.
+    std::atomic<uint64_t> dropped;
+
+    // The next position to push and to pop.  Each gets its own cache line, since producers and the consumer write them from different processes.
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // The slots follow the header.
+    Slot *slots() {
+        return (Slot *)(this + 1);
+    }
+
+    // Whether `slot_count` is one a ring can have: a nonzero power of two.
+    static bool valid_slot_count(const uint32_t slot_count) {
+        return slot_count != 0 && (slot_count & (slot_count - 1)) == 0;
+    }
+
+    // The size of a ring with `slot_count` slots.
+    static size_t size(const uint32_t slot_count) {
+        return sizeof (AgentRing) + slot_count * sizeof (Slot);
+    }
+
+    // Initializes a ring in zeroed memory of at least size(slot_count) bytes.
+    void initialize(const uint32_t slot_count, const pid_t pid, const double rate) {
+        this->slot_count = slot_count;
+        this->pid = pid;
+        this->rate = rate;
+
+        for (uint32_t i = 0; i < slot_count; i++) {
+            slots()[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Publish the ring to drspin last.
+        std::atomic_thread_fence(std::memory_order_release);
+        magic = magic_value;
+    }
+
+    // Pushes a sample.  Returns false (having counted it as dropped) if the ring is full.  Async-signal-safe.
+    bool push(const uint64_t timestamp, const uint32_t lwpid, const uintptr_t *const frames, const size_t depth) {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        Slot *slot;
+
+        for (;;) {
+            slot = &slots()[position & (slot_count - 1)];
+            const int64_t difference = (int64_t)(slot->sequence.load(std::memory_order_acquire) - position);
+
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->timestamp = timestamp;
+        slot->lwpid = lwpid;
+        slot->depth = (uint32_t)(depth < max_depth ? depth : max_depth);
+        memcpy(slot->frames, frames, slot->depth * sizeof (uintptr_t));
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Pops the oldest sample into `sample`.  Returns false if there isn't one (or if its producer hasn't finished writing it yet).  Only one process may pop at a time.
+    //
+    // `slot_count` is the consumer's own copy of the header's, checked (by valid_slot_count()) when it mapped the ring: the header is writable by the target, which could otherwise change it to send the consumer outside the mapping.
+    bool pop(Sample &sample, const uint32_t slot_count) {
+        const uint64_t position = tail.load(std::memory_order_relaxed);
+        Slot &slot = slots()[position & (slot_count - 1)];
+
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) return false;
+
+        sample.timestamp = slot.timestamp;
+        sample.lwpid = slot.lwpid;
+        sample.depth = slot.depth < max_depth ? slot.depth : max_depth;
+        memcpy(sample.frames, slot.frames, sample.depth * sizeof (uintptr_t));
+
+        slot.sequence.store(position + slot_count, std::memory_order_release);
+        tail.store(position + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+};
+
+// The name of the shared memory object for the agent in process `pid`.
+inline std::string agent_ring_name(const pid_t pid) {
+    char name[32];
+    snprintf(name, sizeof (name), "/drspin-agent.%d", (int)pid);
+    return name;
+}
+
+#endif /* AGENT_RING_H */
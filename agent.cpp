@@ -0,0 +1,262 @@
+//
+//  agent.cpp
+//  drspin
+//
+//  The in-process sampling agent, built as libdrspin-agent.so and loaded into the target with LD_PRELOAD.  Each thread gets a timer on its own CPU-time clock that raises SIGPROF; the handler walks the thread's frame pointers and pushes the stack into the shared-memory ring (see agent-ring.h) that `drspin --agent` drains.  Nothing ever stops the target.
+//
+//  The rate, in samples per second of each thread's CPU time, comes from DRSPIN_AGENT_RATE (default 1000).
+//
+
+#include "agent-ring.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#if defined(__FreeBSD__)
+#include <pthread_np.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+// Frames more than this far apart are assumed to be garbage, as in FramePointerUnwinder.
+const uintptr_t max_frame_size = 16 * 1024 * 1024;
+
+static AgentRing *ring;
+static pthread_key_t thread_key;
+static long timer_interval; // in nanoseconds
+
+// What the signal handler needs to know about the current thread, set up when the thread starts.  (Initial-exec TLS is safe to touch from a signal handler; the general dynamic model may allocate.)
+struct ThreadState {
+    bool armed;
+    uint32_t lwpid;
+    uintptr_t stack_start;
+    uintptr_t stack_end;
+    timer_t timer;
+};
+
+static __attribute__((tls_model("initial-exec"))) thread_local ThreadState thread_state;
+
+static uint32_t current_lwpid() {
+#if defined(__FreeBSD__)
+    return pthread_getthreadid_np();
+#elif defined(__linux__)
+    return syscall(SYS_gettid);
+#endif
+}
+
+static void handle_sigprof(int signo, siginfo_t *const info, void *const context) {
+    const ThreadState &state = thread_state;
+    if (!state.armed || !ring->reading.load(std::memory_order_relaxed)) return;
+
+    const int saved_errno = errno;
+    const ucontext_t *const uc = (const ucontext_t *)context;
+
+#if defined(__FreeBSD__) && defined(__x86_64__) && __x86_64__
+    uintptr_t pc = uc->uc_mcontext.mc_rip, fp = uc->uc_mcontext.mc_rbp;
+    const uintptr_t sp = uc->uc_mcontext.mc_rsp;
+#elif defined(__FreeBSD__) && defined(__aarch64__) && __aarch64__
+    uintptr_t pc = uc->uc_mcontext.mc_gpregs.gp_elr, fp = uc->uc_mcontext.mc_gpregs.gp_x[29];
+    const uintptr_t sp = uc->uc_mcontext.mc_gpregs.gp_sp;
+#elif defined(__linux__) && defined(__x86_64__) && __x86_64__
+    uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP], fp = uc->uc_mcontext.gregs[REG_RBP];
+    const uintptr_t sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__linux__) && defined(__aarch64__) && __aarch64__
+    uintptr_t pc = uc->uc_mcontext.pc, fp = uc->uc_mcontext.regs[29];
+    const uintptr_t sp = uc->uc_mcontext.sp;
+#else
+#error don't know how to get pc/fp/sp
+#endif
+
+    // The same walk as FramePointerUnwinder's, except that we can read our own stack directly, as long as we stay between the interrupted SP and the top of the stack.
+    uintptr_t frames[AgentRing::max_depth];
+    size_t depth = 0;
+
+    for (;;) {
+        frames[depth++] = pc;
+        if (depth == AgentRing::max_depth) break;
+
+        if (fp < sp || fp < state.stack_start || fp > state.stack_end - 2 * sizeof (uintptr_t) || fp % sizeof (uintptr_t) != 0) break;
+
+        const uintptr_t next_fp = ((const uintptr_t *)fp)[0];
+        const uintptr_t next_pc = ((const uintptr_t *)fp)[1];
+
+        if (next_fp <= fp || next_fp - fp > max_frame_size) break;
+
+        pc = next_pc;
+        fp = next_fp;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ring->push((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, state.lwpid, frames, depth);
+
+    errno = saved_errno;
+}
+
+// Runs when a thread exits (with any non-null value for `thread_key`).
+static void disarm_thread(void *) {
+    ThreadState &state = thread_state;
+
+    if (state.armed) {
+        state.armed = false;
+        timer_delete(state.timer);
+    }
+}
+
+// Starts sampling the calling thread.
+static void arm_thread() {
+    ThreadState &state = thread_state;
+    if (ring == nullptr || state.armed) return;
+
+    state.lwpid = current_lwpid();
+
+    // Without the stack's bounds, the handler can't walk it safely.
+    pthread_attr_t attr;
+    void *stack_address;
+    size_t stack_size;
+
+#if defined(__FreeBSD__)
+    pthread_attr_init(&attr);
+    if (pthread_attr_get_np(pthread_self(), &attr) != 0) return;
+#elif defined(__linux__)
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return;
+#endif
+
+    const int rv = pthread_attr_getstack(&attr, &stack_address, &stack_size);
+    pthread_attr_destroy(&attr);
+    if (rv != 0) return;
+
+    state.stack_start = (uintptr_t)stack_address;
+    state.stack_end = (uintptr_t)stack_address + stack_size;
+
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+#if defined(__FreeBSD__)
+    event.sigev_notify_thread_id = state.lwpid;
+#elif defined(__linux__)
+    event._sigev_un._tid = state.lwpid;
+#endif
+
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &state.timer) != 0) return;
+
+    const struct itimerspec spec = {
+        .it_interval = { .tv_sec = timer_interval / 1000000000, .tv_nsec = timer_interval % 1000000000 },
+        .it_value = { .tv_sec = timer_interval / 1000000000, .tv_nsec = timer_interval % 1000000000 },
+    };
+
+    if (timer_settime(state.timer, 0, &spec, NULL) != 0) {
+        timer_delete(state.timer);
+        return;
+    }
+
+    state.armed = true;
+    pthread_setspecific(thread_key, &state);
+}
+
+struct ThreadStart {
+    void *(*routine)(void *);
+    void *argument;
+};
+
+static void *start_thread(void *const argument) {
+    const ThreadStart start = *(ThreadStart *)argument;
+    free(argument);
+
+    arm_thread();
+    return start.routine(start.argument);
+}
+
+static void remove_ring() {
+    shm_unlink(agent_ring_name(getpid()).c_str());
+}
+
+// A forked child shares its parent's ring but not its timers, so it just stops sampling.  (A child that execs with LD_PRELOAD still set gets its own agent.)
+static void forget_ring() {
+    ring = nullptr;
+    thread_state.armed = false;
+}
+
+static __attribute__((constructor)) void start_agent() {
+    const char *const rate_string = getenv("DRSPIN_AGENT_RATE");
+    const double rate = rate_string ? strtod(rate_string, NULL) : 1000;
+
+    if (!(rate > 0 && rate <= 1000000)) {
+        fprintf(stderr, "drspin agent: bad DRSPIN_AGENT_RATE\n");
+        return;
+    }
+
+    timer_interval = (long)(1e9 / rate);
+
+    const std::string name = agent_ring_name(getpid());
+    const uint32_t slot_count = AgentRing::default_slot_count;
+    const size_t size = AgentRing::size(slot_count);
+
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "drspin agent: %s: %s\n", name.c_str(), strerror(errno));
+        return;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "drspin agent: %s: %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    void *const memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "drspin agent: %s: %s\n", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    AgentRing *const new_ring = (AgentRing *)memory;
+    new_ring->initialize(slot_count, getpid(), rate);
+
+    pthread_key_create(&thread_key, disarm_thread);
+
+    struct sigaction action = {};
+    action.sa_sigaction = handle_sigprof;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    ring = new_ring;
+    atexit(remove_ring);
+    pthread_atfork(NULL, NULL, forget_ring);
+
+    arm_thread();
+}
+
+// Interposes on pthread_create() so that every new thread arms its own timer.
+extern "C" int pthread_create(pthread_t *const thread, const pthread_attr_t *const attr, void *(*const routine)(void *), void *const argument) {
+    static const auto real_pthread_create = (int (*)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *))dlsym(RTLD_NEXT, "pthread_create");
+
+    if (ring == nullptr) {
+        return real_pthread_create(thread, attr, routine, argument);
+    }
+
+    ThreadStart *const start = (ThreadStart *)malloc(sizeof (ThreadStart));
+    if (start == nullptr) return EAGAIN;
+    *start = { .routine = routine, .argument = argument };
+
+    const int rv = real_pthread_create(thread, attr, start_thread, start);
+    if (rv != 0) free(start);
+
+    return rv;
+}
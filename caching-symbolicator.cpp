@@ -0,0 +1,82 @@
+//
+//  caching-symbolicator.cpp
+//  drspin
+//
+
+#include "caching-symbolicator.h"
+#include <vector>
+
+CachingSymbolicator::CachingSymbolicator(Symbolicator &backend)
+: _backend(&backend), _fallback(nullptr), _misses(0) { }
+
+void CachingSymbolicator::set_backend(Symbolicator &backend) {
+    _backend = &backend;
+    _symbols.clear();
+}
+
+void CachingSymbolicator::set_fallback(Symbolicator *const fallback) {
+    _fallback = fallback;
+    _symbols.clear();
+}
+
+Symbol CachingSymbolicator::symbolicate(const uintptr_t address) {
+    const auto entry = _symbols.find(address);
+    if (entry != _symbols.end()) return entry->second;
+
+    return symbolicate_batch({ address })[0];
+}
+
+std::vector<Symbol> CachingSymbolicator::symbolicate_batch(const std::vector<uintptr_t> &addresses) {
+    // Resolve all the new addresses in one batch, so the backend can still parallelize them.
+    std::vector<uintptr_t> missing;
+
+    for (const uintptr_t address : addresses) {
+        if (_symbols.find(address) == _symbols.end()) {
+            missing.push_back(address);
+        }
+    }
+
+    if (!missing.empty()) {
+        std::vector<Symbol> resolved = _backend->symbolicate_batch(missing);
+        _misses += missing.size();
+
+        if (_fallback != nullptr) {
+            std::vector<size_t> unknown;
+            std::vector<uintptr_t> unknown_addresses;
+
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (resolved[i].function.empty()) {
+                    unknown.push_back(i);
+                    unknown_addresses.push_back(missing[i]);
+                }
+            }
+
+            if (!unknown.empty()) {
+                std::vector<Symbol> retried = _fallback->symbolicate_batch(unknown_addresses);
+
+                for (size_t i = 0; i < unknown.size(); i++) {
+                    if (!retried[i].function.empty()) {
+                        resolved[unknown[i]] = std::move(retried[i]);
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < missing.size(); i++) {
+            _symbols.emplace(missing[i], std::move(resolved[i]));
+        }
+    }
+
+    std::vector<Symbol> symbols;
+    symbols.reserve(addresses.size());
+
+    for (const uintptr_t address : addresses) {
+        symbols.push_back(_symbols.find(address)->second);
+    }
+
+    return symbols;
+}
+
+uint64_t CachingSymbolicator::misses() const {
+    return _misses;
+}
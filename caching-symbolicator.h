@@ -0,0 +1,39 @@
+//
+//  caching-symbolicator.h
+//  drspin
+//
+
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#ifndef CACHING_SYMBOLICATOR_H
+#define CACHING_SYMBOLICATOR_H
+
+// Remembers what each address symbolicated to, so that a sequence of reports over the same process (e.g., the windows of `drspin continuous`) only sends new addresses to the backend.
+//
+// It can also mix two backends: addresses the first can't place in a function are tried on a second (e.g., LLDB after the native symbolicator), with both answers going into the same cache.
+struct CachingSymbolicator : public Symbolicator, private DeleteImplicit {
+    CachingSymbolicator(Symbolicator &backend);
+
+    // Switches to another backend (e.g., because the target's libraries have changed), forgetting everything cached.
+    void set_backend(Symbolicator &backend);
+
+    // Sends addresses that the backend can't place in a function to `fallback` (unless it's null), in one batch, and keeps its answer if it can.
+    void set_fallback(Symbolicator *fallback);
+
+    Symbol symbolicate(uintptr_t address);
+    std::vector<Symbol> symbolicate_batch(const std::vector<uintptr_t> &addresses);
+
+    // The number of addresses that had to be sent to the backend so far.
+    uint64_t misses() const;
+private:
+    Symbolicator *_backend;
+    Symbolicator *_fallback;
+    std::unordered_map<uintptr_t, Symbol> _symbols;
+    uint64_t _misses;
+};
+
+#endif /* CACHING_SYMBOLICATOR_H */
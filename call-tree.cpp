@@ -0,0 +1,80 @@
+//
+//  call-tree.cpp
+//  drspin
+//
+
+#include "call-tree.h"
+#include <assert.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+CallTree::CallTree() {
+    _nodes.push_back({ .address = 0, .count = 0, .parent = root });
+}
+
+void CallTree::add(const uintptr_t *const frames, const size_t depth, const unsigned int count) {
+    NodeID node = root;
+    _nodes[root].count += count;
+
+    for (size_t i = 0; i < depth; i++) {
+        const auto [entry, inserted] = _edges.try_emplace({ .parent = node, .address = frames[i] }, (NodeID)_nodes.size());
+
+        if (inserted) {
+            _nodes.push_back({ .address = frames[i], .count = 0, .parent = node });
+        }
+
+        node = entry->second;
+        _nodes[node].count += count;
+    }
+}
+
+void CallTree::sort() {
+    // Bucket the nodes by parent (a counting sort), so that each node's children are contiguous...
+    _child_offsets.assign(_nodes.size() + 1, 0);
+
+    for (NodeID node = 1; node < _nodes.size(); node++) {
+        _child_offsets[_nodes[node].parent + 1]++;
+    }
+
+    for (NodeID node = 0; node < _nodes.size(); node++) {
+        _child_offsets[node + 1] += _child_offsets[node];
+    }
+
+    std::vector<NodeID> next = _child_offsets;
+    _child_list.resize(_nodes.size() - 1);
+
+    for (NodeID node = 1; node < _nodes.size(); node++) {
+        _child_list[next[_nodes[node].parent]++] = node;
+    }
+
+    // ... then order each node's children by descending count.  (Break ties by address, so that output is deterministic.)
+    for (NodeID node = 0; node < _nodes.size(); node++) {
+        std::sort(_child_list.begin() + _child_offsets[node], _child_list.begin() + _child_offsets[node + 1], [this](const NodeID a, const NodeID b) {
+            if (_nodes[a].count != _nodes[b].count) {
+                return _nodes[a].count > _nodes[b].count;
+            }
+
+            return _nodes[a].address < _nodes[b].address;
+        });
+    }
+}
+
+size_t CallTree::size() const {
+    return _nodes.size();
+}
+
+uintptr_t CallTree::address(const NodeID node) const {
+    return _nodes[node].address;
+}
+
+unsigned int CallTree::count(const NodeID node) const {
+    return _nodes[node].count;
+}
+
+std::pair<const CallTree::NodeID *, const CallTree::NodeID *> CallTree::children(const NodeID node) const {
+    assert(_child_offsets.size() == _nodes.size() + 1);
+    const NodeID *const list = _child_list.data();
+
+    return { list + _child_offsets[node], list + _child_offsets[node + 1] };
+}
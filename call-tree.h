@@ -0,0 +1,75 @@
+//
+//  call-tree.h
+//  drspin
+//
+
+#include "trie-edge.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef CALL_TREE_H
+#define CALL_TREE_H
+
+// An aggregated call tree, for reporting.
+//
+// Nodes live in a single contiguous arena and refer to each other by index; a hash table maps (parent, address) to child, so adding a stack is one lookup per frame.  sort() then lays out each node's children contiguously, by descending count, and traversal is a loop over an explicit stack -- no recursion -- so huge or deep trees are cheap to sort and print.
+struct CallTree {
+    using NodeID = uint32_t;
+    static constexpr NodeID root = 0;
+
+    CallTree();
+
+    // Adds `count` samples of a stack, given outermost frame first.
+    void add(const uintptr_t *frames, size_t depth, unsigned int count);
+
+    // Must be called after the last add() and before children() or walk().
+    void sort();
+
+    size_t size() const;
+    uintptr_t address(NodeID node) const;
+    unsigned int count(NodeID node) const;
+
+    // The node's children, by descending count.
+    std::pair<const NodeID *, const NodeID *> children(NodeID node) const;
+
+    // Calls `visit(node, depth)` for every node but the root, in depth-first pre-order, visiting children by descending count.  The root's children have depth 0.
+    template<typename Visitor>
+    void walk(Visitor visit) const {
+        std::vector<std::pair<NodeID, unsigned int>> pending;
+        const auto [root_begin, root_end] = children(root);
+
+        for (const NodeID *child = root_end; child != root_begin; child--) {
+            pending.emplace_back(child[-1], 0);
+        }
+
+        while (!pending.empty()) {
+            const auto [node, depth] = pending.back();
+            pending.pop_back();
+            visit(node, depth);
+
+            // Push in reverse so that the first child is visited first.
+            const auto [begin, end] = children(node);
+            for (const NodeID *child = end; child != begin; child--) {
+                pending.emplace_back(child[-1], depth + 1);
+            }
+        }
+    }
+private:
+    struct Node {
+        uintptr_t address;
+        unsigned int count;
+        NodeID parent;
+    };
+
+    std::vector<Node> _nodes;
+    std::unordered_map<TrieEdge, NodeID, TrieEdge::Hash> _edges;
+
+    // Built by sort(): the children of node n are _child_list[_child_offsets[n]] through _child_list[_child_offsets[n + 1] - 1].
+    std::vector<NodeID> _child_offsets;
+    std::vector<NodeID> _child_list;
+};
+
+#endif /* CALL_TREE_H */
@@ -0,0 +1,317 @@
+//
+//  capture.cpp
+//  drspin
+//
+
+#include "capture.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char capture_magic[8] = { 'd', 'r', 's', 'p', 'i', 'n', 'r', 'c' };
+// Version 1 captures don't have thread states.
+const uint64_t capture_version = 2;
+
+enum RecordTag : uint8_t {
+    RECORD_PROCESS = 1,
+    RECORD_NODE,
+    RECORD_SAMPLE,
+    RECORD_LIBRARY,
+    RECORD_AGENT,
+};
+
+static uint64_t zigzag_encode(const int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(const uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Decodes the fields of a capture's records, failing (rather than reading past the end) if the file was cut short.
+struct CaptureCursor {
+    CaptureCursor(const uint8_t *const start, const uint8_t *const end)
+    : _position(start), _end(end) { }
+
+    bool at_end() const {
+        return _position == _end;
+    }
+
+    bool read_byte(uint8_t &byte) {
+        if (_position == _end) return false;
+
+        byte = *_position++;
+        return true;
+    }
+
+    bool read_varint(uint64_t &value) {
+        value = 0;
+
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte;
+            if (!read_byte(byte)) return false;
+
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+
+        return false;
+    }
+
+    bool read_signed(int64_t &value) {
+        uint64_t encoded;
+        if (!read_varint(encoded)) return false;
+
+        value = zigzag_decode(encoded);
+        return true;
+    }
+
+    bool read_string(std::string &string) {
+        uint64_t length;
+        if (!read_varint(length) || length > (uint64_t)(_end - _position)) return false;
+
+        string.assign((const char *)_position, length);
+        _position += length;
+        return true;
+    }
+private:
+    const uint8_t *_position;
+    const uint8_t *const _end;
+};
+
+static void capture_error(const std::string &path, const char *const message) {
+    fprintf(stderr, "drspin: %s: %s\n", path.c_str(), message);
+    exit(1);
+}
+
+CaptureWriter::CaptureWriter(const std::string &path, const pid_t pid, const std::string &name)
+: _path(path), _file(fopen(path.c_str(), "w")), _written_nodes(1), _last_lwpid(0), _last_timestamp(0), _samples(0) {
+    if (_file == NULL) {
+        capture_error(_path, strerror(errno));
+    }
+
+    // Samples are written one small record at a time, so a large buffer saves write() calls during sampling.
+    setvbuf(_file, NULL, _IOFBF, 256 * 1024);
+
+    fwrite(capture_magic, sizeof (capture_magic), 1, _file);
+    write_varint(capture_version);
+
+    write_byte(RECORD_PROCESS);
+    write_varint(pid);
+    write_string(name);
+}
+
+CaptureWriter::~CaptureWriter() {
+    if (_file != NULL) {
+        fclose(_file);
+    }
+}
+
+void CaptureWriter::write_byte(const uint8_t byte) {
+    putc(byte, _file);
+}
+
+void CaptureWriter::write_varint(uint64_t value) {
+    while (value >= 0x80) {
+        write_byte((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+
+    write_byte(value);
+}
+
+void CaptureWriter::write_signed(const int64_t value) {
+    write_varint(zigzag_encode(value));
+}
+
+void CaptureWriter::write_string(const std::string &string) {
+    write_varint(string.size());
+    fwrite(string.data(), 1, string.size(), _file);
+}
+
+void CaptureWriter::add_sample(const StackTrie &stacks, const lwpid_t lwpid, const uint64_t timestamp, const StackTrie::NodeID stack, const bool on_cpu, const uint64_t cpu_time) {
+    for (; _written_nodes < stacks.size(); _written_nodes++) {
+        const StackTrie::NodeID parent = stacks.parent(_written_nodes);
+
+        write_byte(RECORD_NODE);
+        write_varint(_written_nodes - parent);
+        write_signed((int64_t)(stacks.address(_written_nodes) - stacks.address(parent)));
+    }
+
+    // A thread's stack often stays the same from one sample to the next (e.g., while it's blocked), so relative to its last stack, it usually encodes as a single zero byte.
+    StackTrie::NodeID &last_stack = _last_stacks.try_emplace(lwpid, StackTrie::root).first->second;
+
+    write_byte(RECORD_SAMPLE);
+    write_signed((int64_t)lwpid - _last_lwpid);
+    write_varint(timestamp - _last_timestamp);
+    write_signed((int64_t)stack - last_stack);
+    write_varint(cpu_time << 1 | on_cpu);
+
+    _last_lwpid = lwpid;
+    _last_timestamp = timestamp;
+    last_stack = stack;
+    _samples++;
+}
+
+void CaptureWriter::add_agent() {
+    write_byte(RECORD_AGENT);
+}
+
+void CaptureWriter::add_libraries(const std::vector<LoadedLibrary> &libraries) {
+    for (const LoadedLibrary &library : libraries) {
+        if (std::find(_written_libraries.begin(), _written_libraries.end(), library) != _written_libraries.end()) continue;
+
+        write_byte(RECORD_LIBRARY);
+        write_string(library.path);
+        write_varint(library.load_address);
+        write_string(library.build_id);
+        _written_libraries.push_back(library);
+    }
+
+    fflush(_file);
+}
+
+void CaptureWriter::finish() {
+    const bool failed = ferror(_file) || fclose(_file) != 0;
+    _file = NULL;
+
+    if (failed) {
+        capture_error(_path, "couldn't write capture");
+    }
+}
+
+uint64_t CaptureWriter::samples() const {
+    return _samples;
+}
+
+CaptureReader::CaptureReader(const std::string &path)
+: _samples(0), _duration(0) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        capture_error(path, strerror(errno));
+    } else if (st.st_size < (off_t)sizeof (capture_magic)) {
+        capture_error(path, "not a drspin capture");
+    }
+
+    const MappedFile file(path);
+    const uint8_t *const start = file.read<uint8_t>(0);
+    CaptureCursor cursor(start + sizeof (capture_magic), start + file.size());
+
+    uint64_t version;
+    if (memcmp(start, capture_magic, sizeof (capture_magic)) || !cursor.read_varint(version)) {
+        capture_error(path, "not a drspin capture");
+    } else if (version != 1 && version != capture_version) {
+        capture_error(path, "unsupported capture version");
+    }
+
+    uint8_t tag;
+    uint64_t pid;
+    std::string name;
+
+    if (!cursor.read_byte(tag) || tag != RECORD_PROCESS || !cursor.read_varint(pid) || !cursor.read_string(name)) {
+        capture_error(path, "missing process record");
+    }
+
+    _process = std::make_unique<Process>(pid, name);
+    StackTrie &stacks = _process->stacks();
+
+    // Maps the capture's node IDs to ours.  (They should be the same, since both tries were built in the same order.)
+    std::vector<StackTrie::NodeID> nodes = { StackTrie::root };
+    std::unordered_map<lwpid_t, StackTrie::NodeID> last_stacks;
+    int64_t lwpid = 0;
+    uint64_t timestamp = 0;
+    uint64_t first_timestamp = 0;
+    bool rounds = true;
+    bool truncated = false;
+
+    while (!cursor.at_end() && !truncated) {
+        truncated = !cursor.read_byte(tag);
+
+        switch (truncated ? 0 : tag) {
+            case RECORD_NODE: {
+                uint64_t parent_delta;
+                int64_t address_delta;
+                truncated = !cursor.read_varint(parent_delta) || !cursor.read_signed(address_delta) || parent_delta == 0 || parent_delta > nodes.size();
+                if (truncated) break;
+
+                const StackTrie::NodeID parent = nodes[nodes.size() - parent_delta];
+                nodes.push_back(stacks.child(parent, stacks.address(parent) + address_delta));
+                break;
+            }
+            case RECORD_SAMPLE: {
+                int64_t lwpid_delta, stack_delta;
+                uint64_t timestamp_delta, state = 1;
+                truncated = !cursor.read_signed(lwpid_delta) || !cursor.read_varint(timestamp_delta) || !cursor.read_signed(stack_delta) || (version >= 2 && !cursor.read_varint(state));
+                if (truncated) break;
+
+                lwpid += lwpid_delta;
+                timestamp += timestamp_delta;
+
+                if (_samples == 0) {
+                    first_timestamp = timestamp;
+                }
+
+                // Every sample in a round has the round's timestamp.
+                if (rounds && (_samples == 0 || timestamp_delta != 0)) {
+                    _process->begin_round();
+                }
+
+                StackTrie::NodeID &last_stack = last_stacks.try_emplace(lwpid, StackTrie::root).first->second;
+                const uint64_t stack = (int64_t)last_stack + stack_delta;
+                truncated = (stack >= nodes.size());
+                if (truncated) break;
+
+                last_stack = stack;
+                _process->add_sample(lwpid, nodes[stack], timestamp, state & 1, state >> 1);
+                _samples++;
+                break;
+            }
+            case RECORD_LIBRARY: {
+                LoadedLibrary library;
+                uint64_t load_address;
+                truncated = !cursor.read_string(library.path) || !cursor.read_varint(load_address) || !cursor.read_string(library.build_id);
+                if (truncated) break;
+
+                library.load_address = load_address;
+                _libraries.push_back(library);
+                break;
+            }
+            case RECORD_AGENT:
+                rounds = false;
+                break;
+            default:
+                truncated = true;
+                break;
+        }
+    }
+
+    if (truncated) {
+        fprintf(stderr, "drspin: %s: capture is truncated or corrupt; using the %llu samples before the damage\n", path.c_str(), (unsigned long long)_samples);
+    }
+
+    _duration = timestamp - first_timestamp;
+}
+
+Process &CaptureReader::process() {
+    return *_process;
+}
+
+const std::vector<LoadedLibrary> &CaptureReader::libraries() const {
+    return _libraries;
+}
+
+uint64_t CaptureReader::samples() const {
+    return _samples;
+}
+
+uint64_t CaptureReader::duration() const {
+    return _duration;
+}
@@ -0,0 +1,86 @@
+//
+//  capture.h
+//  drspin
+//
+
+#include "elf-symbolicator.h"
+#include "process.h"
+#include "sampler.h"
+#include "stack-trie.h"
+#include "util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// A capture file holds the raw samples from `drspin record`, for `drspin report` to symbolicate and print later (possibly on another machine).
+//
+// The file is the magic "drspinrc" and a format version, followed by records.  Each record is a tag byte and some fields, all of them unsigned LEB128 varints (signed ones zigzag-encoded) or strings (a varint length and the bytes):
+//
+//   PROCESS  pid, name
+//   NODE     a new stack trie node: its ID minus its parent's ID, and its address minus its parent's address (signed)
+//   SAMPLE   thread ID minus the previous sample's (signed), nanoseconds since the previous sample, stack node minus the thread's previous stack node (signed), and the thread's state: the CPU nanoseconds it used since its previous sample, times 2, plus 1 if it was on a CPU (see ThreadState)
+//   LIBRARY  path, load address, build ID (written when sampling starts, and again at the end for any libraries loaded since)
+//   AGENT    (no fields) the samples came from the agent (see agent.cpp), which samples each thread on its own clock, so there are no rounds
+//
+// Every sample in a round (one stop of the target) has the round's timestamp, so a nonzero time delta marks the start of a new round.
+//
+// Node IDs are implicit: the nth NODE record defines node n (the root, node 0, isn't recorded).  A node's record always precedes the first sample that refers to it, so a capture cut short is still readable up to the last complete record.
+struct CaptureWriter : private DeleteImplicit {
+    CaptureWriter(const std::string &path, pid_t pid, const std::string &name);
+    ~CaptureWriter();
+
+    // Records a sample taken at `timestamp` nanoseconds, writing out any of the nodes in `stacks` that haven't been yet.  See Thread::add_sample() for `on_cpu` and `cpu_time`.
+    void add_sample(const StackTrie &stacks, lwpid_t lwpid, uint64_t timestamp, StackTrie::NodeID stack, bool on_cpu, uint64_t cpu_time);
+
+    // Records that the samples come from the agent.  Call before adding any.
+    void add_agent();
+
+    // Records the libraries in `libraries` that haven't been yet, and flushes them to the file.  Call as soon as the libraries are known, so that a capture cut short can still be symbolicated, and again at the end to pick up any loaded while sampling.
+    void add_libraries(const std::vector<LoadedLibrary> &libraries);
+
+    // Flushes the file, exiting with an error if anything couldn't be written.
+    void finish();
+
+    uint64_t samples() const;
+private:
+    void write_byte(uint8_t byte);
+    void write_varint(uint64_t value);
+    void write_signed(int64_t value);
+    void write_string(const std::string &string);
+
+    std::string _path;
+    FILE *_file;
+    StackTrie::NodeID _written_nodes;
+    lwpid_t _last_lwpid;
+    uint64_t _last_timestamp;
+    std::unordered_map<lwpid_t, StackTrie::NodeID> _last_stacks;
+    uint64_t _samples;
+    std::vector<LoadedLibrary> _written_libraries;
+};
+
+// Reads a capture file back into a Process.
+struct CaptureReader : private DeleteImplicit {
+    // Exits with an error if the file can't be read or isn't a capture.
+    CaptureReader(const std::string &path);
+
+    Process &process();
+    const std::vector<LoadedLibrary> &libraries() const;
+    uint64_t samples() const;
+
+    // The time between the first and last samples, in nanoseconds.
+    uint64_t duration() const;
+private:
+    std::unique_ptr<Process> _process;
+    std::vector<LoadedLibrary> _libraries;
+    uint64_t _samples;
+    uint64_t _duration;
+};
+
+#endif /* CAPTURE_H */
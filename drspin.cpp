@@ -5,277 +5,826 @@
 //  Created by Matt Jacobson on 6/2/22.
 //
 
-#include "freebsd-symbolicator.h"
+#include "agent-reader.h"
+#include "caching-symbolicator.h"
+#include "capture.h"
+#include "exporters.h"
+#include "lldb-symbolicator.h"
+#include "offline-symbolicator.h"
+#include "overhead.h"
+#include "process.h"
+#include "profile-diff.h"
+#include "remote-memory.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "symbol-cache.h"
+#include "unwinder.h"
 #include <assert.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <algorithm>
-#include <functional>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
-#include <libutil.h>
+#include <getopt.h>
 #include <unistd.h>
-#include <machine/reg.h>
-#include <sys/ptrace.h>
 #include <sys/types.h>
-#include <sys/user.h>
-#include <sys/wait.h>
 
-struct TreeFrame {
-    TreeFrame(const uintptr_t address) {
-        _address = address;
-        _count = 0;
-    }
+#if defined(__FreeBSD__)
+#include "freebsd-sampler.h"
+#include "freebsd-symbolicator.h"
+#elif defined(__linux__)
+#include "linux-sampler.h"
+#include "linux-symbolicator.h"
+#else
+#error unsupported platform
+#endif
 
-    TreeFrame &child(const uintptr_t address) {
-        for (TreeFrame &child : _children) {
-            if (child._address == address) {
-                return child;
-            }
-        }
+// How often --max-overhead reconsiders the rate, in nanoseconds.
+const uint64_t overhead_window = 250000000;
+
+bool got_signal;
+void handle_signal(int signo) {
+    got_signal = true;
+}
 
-        TreeFrame new_child = TreeFrame(address);
-        _children.push_back(new_child);
+void usage() {
+    fprintf(stderr, "usage:\n"
+            "\tdrspin [--symbolicator native | lldb | mixed] [--format text | bottom-up | top] [<report options>] [--agent] [<options>] <pid> <seconds>\n"
+            "\tdrspin record -o <file> [--agent] [<options>] <pid> <seconds>\n"
+            "\tdrspin continuous -o <prefix> [--window <seconds>] [--keep <count>] [--format <format>] [<report options>] [<options>] <pid>\n"
+            "\tdrspin report [--format <format>] [<report options>] [--sysroot <dir>] [--symbol-cache <dir> | --no-symbol-cache] <file>\n"
+            "\tdrspin diff [--format text | collapsed] [--state all | on-cpu | off-cpu] [--top <count>] [--sysroot <dir>] [--symbol-cache <dir> | --no-symbol-cache] <before> <after>\n"
+            "formats:\n"
+            "\ttext | bottom-up | top | collapsed | pprof | speedscope | trace\n"
+            "report options:\n"
+            "\t[--lines] [--state all | on-cpu | off-cpu] [--top <count>] [--collapse-offsets]\n"
+            "options:\n"
+            "\t[--rate <hz>] [--clock wall | cpu] [--max-overhead <fraction>] [--unwinder fp | dwarf] [--stack-window <bytes>] [--reuse-check <bytes>] [--symbol-cache <dir> | --no-symbol-cache]\n");
+    exit(1);
+}
 
-        return _children.back();
+// Whether the format is one of the human-readable reports, which `drspin report` and plain `drspin` surround with other information.
+bool is_text_format(const ExportFormat format) {
+    return format == ExportFormat::text || format == ExportFormat::bottom_up || format == ExportFormat::top;
+}
+
+// Implements `drspin report`: prints the tree for a capture made by `drspin record`.
+int report(int argc, char *argv[]) {
+    ExportFormat format = ExportFormat::text;
+    std::string sysroot;
+    std::string symbol_cache_directory = SymbolIndexCache::default_directory();
+    bool source_lines = false;
+    ReportOptions report_options;
+
+    enum {
+        OPTION_FORMAT = 1000,
+        OPTION_LINES,
+        OPTION_STATE,
+        OPTION_TOP,
+        OPTION_COLLAPSE_OFFSETS,
+        OPTION_SYSROOT,
+        OPTION_SYMBOL_CACHE,
+        OPTION_NO_SYMBOL_CACHE,
+    };
+
+    const struct option long_options[] = {
+        { "format", required_argument, NULL, OPTION_FORMAT },
+        { "lines", no_argument, NULL, OPTION_LINES },
+        { "state", required_argument, NULL, OPTION_STATE },
+        { "top", required_argument, NULL, OPTION_TOP },
+        { "collapse-offsets", no_argument, NULL, OPTION_COLLAPSE_OFFSETS },
+        { "sysroot", required_argument, NULL, OPTION_SYSROOT },
+        { "symbol-cache", required_argument, NULL, OPTION_SYMBOL_CACHE },
+        { "no-symbol-cache", no_argument, NULL, OPTION_NO_SYMBOL_CACHE },
+        { NULL, 0, NULL, 0 },
+    };
+
+    for (int ch; (ch = getopt_long(argc, argv, "", long_options, NULL)) != -1;) {
+        switch (ch) {
+            case OPTION_FORMAT:
+                if (!parse_export_format(optarg, format)) usage();
+                break;
+            case OPTION_LINES:
+                source_lines = true;
+                break;
+            case OPTION_STATE:
+                if (!parse_sample_filter(optarg, report_options.filter)) usage();
+                break;
+            case OPTION_TOP:
+                report_options.top_count = strtoul(optarg, NULL, 0);
+                break;
+            case OPTION_COLLAPSE_OFFSETS:
+                report_options.collapse_offsets = true;
+                break;
+            case OPTION_SYSROOT:
+                sysroot = optarg;
+                break;
+            case OPTION_SYMBOL_CACHE:
+                symbol_cache_directory = optarg;
+                break;
+            case OPTION_NO_SYMBOL_CACHE:
+                symbol_cache_directory.clear();
+                break;
+            default:
+                usage();
+        }
     }
 
-    void increment(const unsigned int value) {
-        _count += value;
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+        usage();
     }
 
-    virtual void print_tree_with_indentation(unsigned int indentation, Symbolicator &symbolicator) const {
-        printf("%*s%u  %s (%#lx)\n", indentation, "", _count, symbolicator.symbolicate(_address).c_str(), _address);
+    CaptureReader capture(argv[0]);
+    OfflineSymbolicator symbolicator(capture.libraries(), sysroot);
+    symbolicator.set_source_lines(source_lines);
 
-        for (const TreeFrame &child : _children) {
-            child.print_tree_with_indentation(indentation + 2, symbolicator);
-        }
+    const SymbolIndexCache symbol_cache(symbol_cache_directory);
+    if (!symbol_cache_directory.empty()) {
+        symbolicator.set_index_cache(&symbol_cache);
     }
 
-    void print_tree(Symbolicator &symbolicator) const {
-        print_tree_with_indentation(0, symbolicator);
+    if (is_text_format(format)) {
+        printf("Capture %s: %llu samples over %.3f seconds.\n", argv[0], (unsigned long long)capture.samples(), capture.duration() / 1e9);
     }
 
-    void sort() {
-        std::sort(_children.begin(), _children.end(), std::greater<TreeFrame>());
+    export_profile(format, capture.process(), symbolicator, report_options, stdout);
 
-        for (TreeFrame &child : _children) {
-            child.sort();
-        }
+    if (is_text_format(format)) {
+        printf("Binaries:\n");
+        symbolicator.print_libraries();
     }
 
-    bool operator>(const TreeFrame &other) const {
-        return _count > other._count;
+    return 0;
+}
+
+// Implements `drspin diff`: compares two captures made by `drspin record`.
+int diff(int argc, char *argv[]) {
+    bool collapsed = false;
+    std::string sysroot;
+    std::string symbol_cache_directory = SymbolIndexCache::default_directory();
+    SampleFilter filter = SampleFilter::all;
+    size_t top_count = 30;
+
+    enum {
+        OPTION_FORMAT = 1000,
+        OPTION_STATE,
+        OPTION_TOP,
+        OPTION_SYSROOT,
+        OPTION_SYMBOL_CACHE,
+        OPTION_NO_SYMBOL_CACHE,
+    };
+
+    const struct option long_options[] = {
+        { "format", required_argument, NULL, OPTION_FORMAT },
+        { "state", required_argument, NULL, OPTION_STATE },
+        { "top", required_argument, NULL, OPTION_TOP },
+        { "sysroot", required_argument, NULL, OPTION_SYSROOT },
+        { "symbol-cache", required_argument, NULL, OPTION_SYMBOL_CACHE },
+        { "no-symbol-cache", no_argument, NULL, OPTION_NO_SYMBOL_CACHE },
+        { NULL, 0, NULL, 0 },
+    };
+
+    for (int ch; (ch = getopt_long(argc, argv, "", long_options, NULL)) != -1;) {
+        switch (ch) {
+            case OPTION_FORMAT:
+                if (!strcmp(optarg, "text")) {
+                    collapsed = false;
+                } else if (!strcmp(optarg, "collapsed")) {
+                    collapsed = true;
+                } else {
+                    usage();
+                }
+                break;
+            case OPTION_STATE:
+                if (!parse_sample_filter(optarg, filter)) usage();
+                break;
+            case OPTION_TOP:
+                top_count = strtoul(optarg, NULL, 0);
+                break;
+            case OPTION_SYSROOT:
+                sysroot = optarg;
+                break;
+            case OPTION_SYMBOL_CACHE:
+                symbol_cache_directory = optarg;
+                break;
+            case OPTION_NO_SYMBOL_CACHE:
+                symbol_cache_directory.clear();
+                break;
+            default:
+                usage();
+        }
     }
-private:
-    uintptr_t _address;
-    unsigned int _count;
-protected:
-    std::vector<TreeFrame> _children;
-};
 
-struct RootTreeFrame : public TreeFrame {
-    RootTreeFrame() : TreeFrame(0) {}
+    argc -= optind;
+    argv += optind;
 
-    virtual void print_tree_with_indentation(unsigned int indentation, Symbolicator &symbolicator) const {
-        for (const TreeFrame &child : _children) {
-            child.print_tree_with_indentation(indentation, symbolicator);
-        }
+    if (argc != 2) {
+        usage();
     }
-};
 
-struct Thread {
-    using Sample = std::vector<uintptr_t>;
-    const lwpid_t lwpid;
+    const SymbolIndexCache symbol_cache(symbol_cache_directory);
+    ProfileDiff profile_diff;
 
-    Thread(const lwpid_t lwpid)
-    : lwpid(lwpid) { }
+    // Read one capture at a time, so that only one is held in memory.
+    for (const ProfileDiff::Side side : { ProfileDiff::before, ProfileDiff::after }) {
+        CaptureReader capture(argv[side]);
+        OfflineSymbolicator symbolicator(capture.libraries(), sysroot);
 
-    void add_sample(const Sample &&sample) {
-        _samples.push_back(sample);
+        if (!symbol_cache_directory.empty()) {
+            symbolicator.set_index_cache(&symbol_cache);
+        }
+
+        profile_diff.add(side, capture.process(), symbolicator, filter);
     }
 
-    void print_tree(Symbolicator &symbolicator) const {
-        printf("  Thread %#x:\n", this->lwpid);
-        RootTreeFrame root_frame;
+    if (collapsed) {
+        profile_diff.export_collapsed(stdout);
+    } else {
+        printf("Comparing captures %s (before) and %s (after).\n", argv[0], argv[1]);
+        profile_diff.print(top_count, stdout);
+    }
 
-        for (const Sample &sample : _samples) {
-            TreeFrame *cur_frame = &root_frame;
+    return 0;
+}
 
-            for (const uintptr_t addr : sample) {
-                cur_frame = &cur_frame->child(addr);
-                cur_frame->increment(1);
+// Samples the target into `process` until `scheduler`'s duration is up or we're interrupted, recording each sample to `capture` if it isn't null.  The target must be stopped on entry, and is stopped again on return.
+void sample(Sampler &sampler, RemoteMemory &memory, Unwinder &unwinder, Process &process, SampleScheduler &scheduler, OverheadMonitor &overhead, CaptureWriter *const capture, const double max_overhead) {
+    scheduler.start();
+    overhead.begin_sample();
+
+    for (;;) {
+        const uint64_t timestamp = monotonic_time();
+        const std::vector<lwpid_t> lwpids = sampler.threads();
+        process.begin_round();
+        overhead.end_phase(OverheadMonitor::PHASE_ENUMERATE);
+
+        for (const lwpid_t lwpid : lwpids) {
+            const Registers regs = sampler.registers(lwpid);
+            overhead.end_phase(OverheadMonitor::PHASE_REGISTERS);
+
+            // A new thread may have an exited thread's ID (and even its registers, if it got the same stack), so only threads we've sampled before can repeat a sample.
+            Thread &thread = process.thread(lwpid);
+            const ThreadState state = sampler.thread_state(lwpid);
+            const uint64_t cpu_time = thread.cpu_time_since_last(state.cpu_time);
+            const bool reuse = (thread.last_stack() != StackTrie::none && unwinder.unchanged(lwpid, regs));
+            const StackTrie::NodeID stack = reuse ? thread.repeat_last_sample(timestamp, state.on_cpu, cpu_time) : process.add_sample(thread, unwinder.unwind(lwpid, regs), timestamp, state.on_cpu, cpu_time);
+
+            if (capture) {
+                capture->add_sample(process.stacks(), lwpid, timestamp, stack, state.on_cpu, cpu_time);
             }
+
+            overhead.end_phase(OverheadMonitor::PHASE_UNWIND);
         }
 
-        root_frame.sort();
-        root_frame.print_tree_with_indentation(2, symbolicator);
+#if 0
         printf("\n");
+#endif /* 0 */
+
+        sampler.resume();
+        overhead.end_phase(OverheadMonitor::PHASE_RESUME);
+        overhead.end_sample();
+
+        // Stopped time per sample is roughly constant, so the stopped fraction scales with the rate.
+        if (max_overhead > 0) {
+            const double fraction = overhead.window_stopped_fraction(overhead_window);
+
+            if (fraction > max_overhead) {
+                scheduler.set_rate(scheduler.rate() * max_overhead / fraction);
+            }
+        }
+
+        const bool more = scheduler.wait(got_signal);
+
+        // This reads the threads' states while they're still running, so it isn't part of the time the target is stopped.
+        sampler.read_thread_states();
+
+        overhead.begin_sample();
+        sampler.request_stop();
+        overhead.end_phase(OverheadMonitor::PHASE_STOP);
+        sampler.wait_for_stop();
+        overhead.end_phase(OverheadMonitor::PHASE_WAIT);
+        memory.invalidate();
+
+        if (!more) break;
     }
+}
 
-private:
-    std::vector<Sample> _samples;
-};
+// Finds the target's libraries, which may mean reading its memory, so the target must be stopped.
+std::unique_ptr<ELFSymbolicator> make_symbolicator(const pid_t pid, RemoteMemory &memory) {
+#if defined(__FreeBSD__)
+    return std::make_unique<FreeBSDUserSymbolicator>(pid, memory);
+#elif defined(__linux__)
+    return std::make_unique<LinuxSymbolicator>(pid);
+#endif
+}
+
+// Finds the target's libraries without stopping it, where possible.  On FreeBSD, the dynamic linker's list has to be read out of the target while it's stopped, so it's stopped just this once.
+std::unique_ptr<ELFSymbolicator> make_symbolicator_running(Sampler &sampler, const pid_t pid, RemoteMemory &memory) {
+#if defined(__FreeBSD__)
+    sampler.attach();
+    std::unique_ptr<ELFSymbolicator> symbolicator = make_symbolicator(pid, memory);
+    sampler.detach();
+    return symbolicator;
+#elif defined(__linux__)
+    return make_symbolicator(pid, memory);
+#endif
+}
+
+// Reads samples from the target's agent into `process` for `seconds` or until we're interrupted or the target exits, recording each sample to `capture` if it isn't null.  The target keeps running throughout.
+void read_agent(AgentReader &agent, Process &process, const double seconds, CaptureWriter *const capture) {
+    // The ring holds thousands of samples, so draining it every few milliseconds keeps up with even a fast agent in a busy target.
+    const struct timespec poll_interval = { .tv_sec = 0, .tv_nsec = 5000000 };
+    const uint64_t end_time = monotonic_time() + (uint64_t)(seconds * 1e9);
 
-struct Process : private DeleteImplicit {
-    Process(const pid_t pid) {
-        _pid = pid;
-        _info = kinfo_getproc(pid);
-        assert(_info != NULL);
+    while (!got_signal && monotonic_time() < end_time && !agent.target_exited()) {
+        agent.drain(process, capture);
+        nanosleep(&poll_interval, NULL);
     }
 
-    const char *name() {
-        return _info->ki_comm;
+    agent.drain(process, capture);
+}
+
+const char *export_extension(const ExportFormat format) {
+    switch (format) {
+        case ExportFormat::text: return "txt";
+        case ExportFormat::bottom_up: return "bottom-up.txt";
+        case ExportFormat::top: return "top.txt";
+        case ExportFormat::collapsed: return "folded";
+        case ExportFormat::pprof: return "pb";
+        case ExportFormat::speedscope: return "speedscope.json";
+        case ExportFormat::trace: return "trace.json";
     }
 
-    Thread &thread(const lwpid_t lwpid) {
-        for (Thread &thread : _threads) {
-            if (thread.lwpid == lwpid) {
-                return thread;
+    abort();
+}
+
+// Settings for `drspin continuous`.
+struct ContinuousSettings {
+    std::string output_prefix;
+    double window_seconds;
+    size_t keep;
+    ExportFormat format;
+    double rate;
+    SampleClock clock;
+    double max_overhead;
+    const SymbolIndexCache *symbol_cache;
+    bool source_lines;
+    ReportOptions report_options;
+};
+
+// Implements `drspin continuous`: samples the target until interrupted (or until it exits), writing a profile of each window to its own file and deleting all but the most recent few.
+//
+// Only one window's samples are held at a time.  Symbols are cached across windows, so each window only symbolicates addresses no earlier window has seen, unless the target's libraries change.
+void sample_continuously(Sampler &sampler, RemoteMemory &memory, Unwinder &unwinder, const pid_t pid, const ContinuousSettings &settings) {
+    const std::string name = sampler.process_name();
+    OverheadMonitor overhead;
+    double rate = settings.rate;
+
+    std::unique_ptr<ELFSymbolicator> backend;
+    std::vector<LoadedLibrary> libraries;
+    std::unique_ptr<CachingSymbolicator> symbolicator;
+    std::deque<std::string> paths;
+
+    printf("Sampling process %s [%d] at %g samples per second of %s time, writing a profile every %g seconds to %s.*.%s...\n", name.c_str(), pid, rate, settings.clock == SampleClock::wall ? "wall-clock" : "CPU", settings.window_seconds, settings.output_prefix.c_str(), export_extension(settings.format));
+    fflush(stdout);
+
+    // Uses `current`, the target's libraries, if they've changed: start over with a new symbolicator (and forget the cached symbols, some of which may now be wrong), keeping the unwind tables of the libraries that are still loaded.  The new libraries' tables are built by prepare_libraries(), once the target is running again.
+    const auto use_libraries = [&](std::unique_ptr<ELFSymbolicator> current) {
+        std::vector<LoadedLibrary> current_libraries = current->loaded_libraries();
+
+        if (!backend || current_libraries != libraries) {
+            if (backend) {
+                current->adopt_unwind_tables(*backend);
+            }
+
+            backend = std::move(current);
+            libraries = std::move(current_libraries);
+            backend->set_index_cache(settings.symbol_cache);
+            backend->set_source_lines(settings.source_lines);
+            unwinder.set_libraries(backend.get());
+
+            if (symbolicator) {
+                symbolicator->set_backend(*backend);
+            } else {
+                symbolicator = std::make_unique<CachingSymbolicator>(*backend);
             }
         }
+    };
 
-        return _threads.emplace_back(lwpid);
-    }
+    use_libraries(make_symbolicator_running(sampler, pid, memory));
+    unwinder.prepare_libraries();
+    sampler.attach();
+
+    for (uint64_t window = 0;; window++) {
+        Process process(pid, name);
+        SampleScheduler scheduler(pid, rate, settings.clock, settings.window_seconds);
+
+        // The new Process's threads have no last sample to repeat.
+        unwinder.reset();
 
-    void print_tree(Symbolicator &symbolicator) const {
-        printf("Process: %s [%d]\n\n", _info->ki_comm, _pid);
+        sample(sampler, memory, unwinder, process, scheduler, overhead, nullptr, settings.max_overhead);
+        rate = scheduler.rate();
 
-        for (const Thread &thread : _threads) {
-            thread.print_tree(symbolicator);
+        const bool exited = sampler.threads().empty();
+
+        // Pick up any libraries loaded during the window, both to symbolicate it and to unwind the next one.  Finding them is only safe while the target is stopped.
+        if (!exited) {
+            use_libraries(make_symbolicator(pid, memory));
         }
-    }
 
-    ~Process() {
-        free(_info);
+        // Let the target run while we symbolicate, write, and compile any new libraries' CFI.
+        sampler.resume();
+        unwinder.prepare_libraries();
+
+        char timestamp[32];
+        const time_t now = time(NULL);
+        strftime(timestamp, sizeof (timestamp), "%Y%m%dT%H%M%S", localtime(&now));
+
+        // The window number keeps names unique even if windows are shorter than a second.
+        const std::string path = settings.output_prefix + "." + timestamp + "." + std::to_string(window) + "." + export_extension(settings.format);
+        const std::string temporary_path = path + ".tmp";
+
+        // Write to a temporary file and rename it into place, so that nothing ever sees a partial profile.
+        FILE *const file = fopen(temporary_path.c_str(), "w");
+
+        if (file == NULL) {
+            fprintf(stderr, "drspin: %s: %s\n", temporary_path.c_str(), strerror(errno));
+        } else {
+            export_profile(settings.format, process, *symbolicator, settings.report_options, file);
+            const bool failed = ferror(file);
+
+            if (fclose(file) != 0 || failed || rename(temporary_path.c_str(), path.c_str()) != 0) {
+                fprintf(stderr, "drspin: couldn't write %s\n", path.c_str());
+                unlink(temporary_path.c_str());
+            } else {
+                paths.push_back(path);
+            }
+        }
+
+        while (settings.keep > 0 && paths.size() > settings.keep) {
+            unlink(paths.front().c_str());
+            paths.pop_front();
+        }
+
+        printf("Window %llu: %llu samples at %.1f Hz (%llu missed ticks), %zu stack trie nodes, %llu addresses symbolicated so far; wrote %s\n",
+               (unsigned long long)window, (unsigned long long)scheduler.samples(), scheduler.achieved_rate(), (unsigned long long)scheduler.missed_ticks(),
+               process.stacks().size() - 1, (unsigned long long)symbolicator->misses(), path.c_str());
+        fflush(stdout);
+
+        sampler.stop();
+        memory.invalidate();
+
+        if (exited || got_signal) break;
     }
-private:
-    pid_t _pid;
-    struct kinfo_proc *_info;
-    std::vector<Thread> _threads;
-};
 
-bool got_signal;
-void handle_signal(int signo) {
-    got_signal = true;
+    sampler.detach();
+
+    printf("Sampling stopped.\n\nOverhead:\n");
+    overhead.print_statistics(sampler.syscalls());
 }
 
-int main(int argc, const char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "usage:\n\tdrspin <pid> <seconds>\n");
-        exit(1);
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && !strcmp(argv[1], "report")) {
+        return report(argc - 1, argv + 1);
+    }
+
+    if (argc >= 2 && !strcmp(argv[1], "diff")) {
+        return diff(argc - 1, argv + 1);
     }
 
-    int rv;
-    const pid_t pid = atoi(argv[1]);
-    const int seconds = atoi(argv[2]);
+    // `drspin record` samples just like plain `drspin`, but saves the samples instead of symbolicating them.  `drspin continuous` samples until it's interrupted, in windows.
+    enum class Mode { live, record, continuous } mode = Mode::live;
+
+    if (argc >= 2 && !strcmp(argv[1], "record")) {
+        mode = Mode::record;
+    } else if (argc >= 2 && !strcmp(argv[1], "continuous")) {
+        mode = Mode::continuous;
+    }
+
+    if (mode != Mode::live) {
+        argc--;
+        argv++;
+    }
+
+    std::string output_path;
+    double rate = 1000;
+    SampleClock clock = SampleClock::wall;
+    double max_overhead = 0;
+    double window_seconds = 60;
+    size_t keep = 24;
+    ExportFormat format = ExportFormat::text;
+    enum class SymbolicatorKind { native, lldb, mixed } symbolicator_kind = SymbolicatorKind::native;
+    bool source_lines = false;
+    ReportOptions report_options;
+    bool use_agent = false;
+    bool dwarf_unwinder = false;
+    size_t stack_window_size = Unwinder::default_window_size;
+    size_t reuse_check_size = 0;
+    std::string symbol_cache_directory = SymbolIndexCache::default_directory();
+
+    enum {
+        OPTION_RATE = 1000,
+        OPTION_CLOCK,
+        OPTION_MAX_OVERHEAD,
+        OPTION_WINDOW,
+        OPTION_KEEP,
+        OPTION_FORMAT,
+        OPTION_SYMBOLICATOR,
+        OPTION_LINES,
+        OPTION_STATE,
+        OPTION_TOP,
+        OPTION_COLLAPSE_OFFSETS,
+        OPTION_AGENT,
+        OPTION_UNWINDER,
+        OPTION_STACK_WINDOW,
+        OPTION_REUSE_CHECK,
+        OPTION_SYMBOL_CACHE,
+        OPTION_NO_SYMBOL_CACHE,
+    };
+
+    const struct option long_options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { "rate", required_argument, NULL, OPTION_RATE },
+        { "clock", required_argument, NULL, OPTION_CLOCK },
+        { "max-overhead", required_argument, NULL, OPTION_MAX_OVERHEAD },
+        { "window", required_argument, NULL, OPTION_WINDOW },
+        { "keep", required_argument, NULL, OPTION_KEEP },
+        { "format", required_argument, NULL, OPTION_FORMAT },
+        { "symbolicator", required_argument, NULL, OPTION_SYMBOLICATOR },
+        { "lines", no_argument, NULL, OPTION_LINES },
+        { "state", required_argument, NULL, OPTION_STATE },
+        { "top", required_argument, NULL, OPTION_TOP },
+        { "collapse-offsets", no_argument, NULL, OPTION_COLLAPSE_OFFSETS },
+        { "agent", no_argument, NULL, OPTION_AGENT },
+        { "unwinder", required_argument, NULL, OPTION_UNWINDER },
+        { "stack-window", required_argument, NULL, OPTION_STACK_WINDOW },
+        { "reuse-check", required_argument, NULL, OPTION_REUSE_CHECK },
+        { "symbol-cache", required_argument, NULL, OPTION_SYMBOL_CACHE },
+        { "no-symbol-cache", no_argument, NULL, OPTION_NO_SYMBOL_CACHE },
+        { NULL, 0, NULL, 0 },
+    };
+
+    for (int ch; (ch = getopt_long(argc, argv, mode != Mode::live ? "o:" : "", long_options, NULL)) != -1;) {
+        switch (ch) {
+            case 'o':
+                if (mode == Mode::live) usage();
+                output_path = optarg;
+                break;
+            case OPTION_RATE:
+                rate = strtod(optarg, NULL);
+                if (!(rate > 0)) usage();
+                break;
+            case OPTION_CLOCK:
+                if (!strcmp(optarg, "wall")) {
+                    clock = SampleClock::wall;
+                } else if (!strcmp(optarg, "cpu")) {
+                    clock = SampleClock::cpu;
+                } else {
+                    usage();
+                }
+                break;
+            case OPTION_MAX_OVERHEAD:
+                max_overhead = strtod(optarg, NULL);
+                if (!(max_overhead > 0 && max_overhead < 1)) usage();
+                break;
+            case OPTION_WINDOW:
+                window_seconds = strtod(optarg, NULL);
+                if (mode != Mode::continuous || !(window_seconds > 0)) usage();
+                break;
+            case OPTION_KEEP:
+                keep = strtoul(optarg, NULL, 0);
+                if (mode != Mode::continuous) usage();
+                break;
+            case OPTION_FORMAT:
+                // Plain `drspin` prints its report along with other information, so it only makes the text ones.
+                if (mode == Mode::record || !parse_export_format(optarg, format)) usage();
+                if (mode == Mode::live && !is_text_format(format)) usage();
+                break;
+            case OPTION_SYMBOLICATOR:
+                // LLDB has to attach to the target, so it can only symbolicate once we've let go of it.
+                if (mode != Mode::live) usage();
+
+                if (!strcmp(optarg, "native")) {
+                    symbolicator_kind = SymbolicatorKind::native;
+                } else if (!strcmp(optarg, "lldb")) {
+                    symbolicator_kind = SymbolicatorKind::lldb;
+                } else if (!strcmp(optarg, "mixed")) {
+                    symbolicator_kind = SymbolicatorKind::mixed;
+                } else {
+                    usage();
+                }
+                break;
+            case OPTION_LINES:
+                // A recording is symbolicated later, by `drspin report`.
+                if (mode == Mode::record) usage();
+                source_lines = true;
+                break;
+            case OPTION_STATE:
+                // A recording keeps every sample's state, for `drspin report --state`.
+                if (mode == Mode::record || !parse_sample_filter(optarg, report_options.filter)) usage();
+                break;
+            case OPTION_TOP:
+                if (mode == Mode::record) usage();
+                report_options.top_count = strtoul(optarg, NULL, 0);
+                break;
+            case OPTION_COLLAPSE_OFFSETS:
+                if (mode == Mode::record) usage();
+                report_options.collapse_offsets = true;
+                break;
+            case OPTION_AGENT:
+                if (mode == Mode::continuous) usage();
+                use_agent = true;
+                break;
+            case OPTION_UNWINDER:
+                if (!strcmp(optarg, "fp")) {
+                    dwarf_unwinder = false;
+                } else if (!strcmp(optarg, "dwarf")) {
+                    dwarf_unwinder = true;
+                } else {
+                    usage();
+                }
+                break;
+            case OPTION_STACK_WINDOW:
+                stack_window_size = strtoul(optarg, NULL, 0);
+                break;
+            case OPTION_REUSE_CHECK:
+                reuse_check_size = strtoul(optarg, NULL, 0);
+                break;
+            case OPTION_SYMBOL_CACHE:
+                symbol_cache_directory = optarg;
+                break;
+            case OPTION_NO_SYMBOL_CACHE:
+                symbol_cache_directory.clear();
+                break;
+            default:
+                usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != (mode == Mode::continuous ? 1 : 2) || (mode == Mode::live) != output_path.empty()) {
+        usage();
+    }
+
+    const pid_t pid = atoi(argv[0]);
 
     signal(SIGHUP, handle_signal);
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    Process process(pid);
+#if defined(__FreeBSD__)
+    FreeBSDSampler sampler(pid);
+#elif defined(__linux__)
+    LinuxSampler sampler(pid);
+#endif
+
+    RemoteMemory memory(sampler);
+    std::unique_ptr<Unwinder> unwinder;
+
+    if (dwarf_unwinder) {
+        unwinder = std::make_unique<DwarfUnwinder>(memory, stack_window_size, reuse_check_size);
+    } else {
+        unwinder = std::make_unique<FramePointerUnwinder>(memory, stack_window_size, reuse_check_size);
+    }
 
-    printf("Sampling process %s [%d] for %d seconds with 1 millisecond of run time between samples...\n", process.name(), pid, seconds);
+    const SymbolIndexCache symbol_cache(symbol_cache_directory);
+
+    if (mode == Mode::continuous) {
+        const ContinuousSettings settings = {
+            .output_prefix = output_path,
+            .window_seconds = window_seconds,
+            .keep = keep,
+            .format = format,
+            .rate = rate,
+            .clock = clock,
+            .max_overhead = max_overhead,
+            .symbol_cache = symbol_cache_directory.empty() ? nullptr : &symbol_cache,
+            .source_lines = source_lines,
+            .report_options = report_options,
+        };
+
+        sample_continuously(sampler, memory, *unwinder, pid, settings);
+        return 0;
+    }
 
-    rv = ptrace(PT_ATTACH, pid, 0, 0);
-    assert(!rv);
+    const double seconds = strtod(argv[1], NULL);
+    Process process(pid, sampler.process_name());
+    SampleScheduler scheduler(pid, rate, clock, seconds);
+    OverheadMonitor overhead;
+    std::unique_ptr<CaptureWriter> capture;
 
-    for (int i = 0; i < seconds * 1000 && !got_signal; i++) {
-        int status;
-        const pid_t waited_pid = wait(&status);
-        assert(pid == waited_pid);
+    if (mode == Mode::record) {
+        capture = std::make_unique<CaptureWriter>(output_path, pid, process.name());
+    }
 
-        lwpid_t lwpids[64];
-        const int num_lwp = ptrace(PT_GETLWPLIST, pid, (caddr_t)lwpids, 64);
-        assert(num_lwp > 0);
+    std::unique_ptr<AgentReader> agent;
+    std::unique_ptr<ELFSymbolicator> symbolicator;
+    SyscallCounts syscalls;
 
-        for (int j = 0; j < num_lwp; j++) {
-            const lwpid_t lwpid = lwpids[j];
-            std::vector<uintptr_t> stack;
+    if (use_agent) {
+        // The agent unwinds with frame pointers at its own rate, so the sampling options don't apply.
+        agent = std::make_unique<AgentReader>(pid);
 
-            struct reg regs;
-            rv = ptrace(PT_GETREGS, lwpid, (caddr_t)&regs, 0);
-            assert(!rv);
+        if (capture) {
+            capture->add_agent();
+        }
 
-#if defined(__x86_64__) && __x86_64__
-            uintptr_t pc = regs.r_rip;
-            uintptr_t fp = regs.r_rbp;
-#elif defined(__aarch64__) && __aarch64__
-            uintptr_t pc = regs.elr; // "exception link register" -- i.e., PC saved from when we interrupted the process
-            uintptr_t fp = regs.x[29]; // x29 by convention
-#else
-#error don't know how to get pc/fp
-#endif
+        printf("Reading samples of process %s [%d] for %g seconds from its agent, at %g samples per second of each thread's CPU time...\n", process.name(), pid, seconds, agent->rate());
+        fflush(stdout);
 
-            for (;;) {
-#if 0
-                printf("pc == %lx, fp == %lx\n", pc, fp);
-#endif /* 0 */
-                stack.insert(stack.begin(), pc);
-
-                uintptr_t data[2];
-                struct ptrace_io_desc io_desc = {
-                    .piod_op = PIOD_READ_D,
-                    .piod_offs = (void *)fp,
-                    .piod_addr = data,
-                    .piod_len = sizeof (data),
-                };
-                rv = ptrace(PT_IO, pid, (caddr_t)&io_desc, 0);
-                const bool fault = (errno == EFAULT);
-                assert(!rv || fault);
-
-#if (defined(__x86_64__) && __x86_64__) || (defined(__aarch64__) && __aarch64__)
-                const uintptr_t next_fp = data[0];
-                const uintptr_t next_pc = data[1];
-#else
-#error don't know how to get next pc/fp
-#endif
+        if (capture) {
+            capture->add_libraries(make_symbolicator_running(sampler, pid, memory)->loaded_libraries());
+        }
 
-                if (next_fp <= fp || next_fp - fp > 1024 * 1024 || fault) {
-#if 0
-                    printf("next_fp: %lx (fault: %s)\n", next_fp, fault ? "YES" : "NO");
-#endif /* 0 */
-                    break;
-                }
+        read_agent(*agent, process, seconds, capture.get());
+        symbolicator = make_symbolicator_running(sampler, pid, memory);
+    } else {
+        printf("Sampling process %s [%d] for %g seconds at %g samples per second of %s time...\n", process.name(), pid, seconds, rate, clock == SampleClock::wall ? "wall-clock" : "CPU");
 
-                pc = next_pc;
-                fp = next_fp;
-            }
+        // The DWARF unwinder needs to know where the libraries are, and a capture records them before any samples.  Find them, and compile their CFI, before attaching, so that the target isn't stopped meanwhile.  (Any loaded since are unwound with the frame pointer, and recorded at the end.)
+        std::unique_ptr<ELFSymbolicator> libraries;
 
-            process.thread(lwpid).add_sample(std::move(stack));
+        if (dwarf_unwinder || capture) {
+            libraries = make_symbolicator_running(sampler, pid, memory);
         }
 
-#if 0
-        printf("\n");
-#endif /* 0 */
+        if (dwarf_unwinder) {
+            unwinder->set_libraries(libraries.get());
+            unwinder->prepare_libraries();
+        }
+
+        if (capture) {
+            capture->add_libraries(libraries->loaded_libraries());
+        }
+
+        sampler.attach();
 
-        rv = ptrace(PT_CONTINUE, pid, (caddr_t)1, 0);
-        assert(!rv);
+        sample(sampler, memory, *unwinder, process, scheduler, overhead, capture.get(), max_overhead);
 
-        usleep(1000);
+        syscalls = sampler.syscalls();
 
-        kill(pid, SIGSTOP);
+        // Finding the libraries may read the target's memory, but nothing after that does, so let the target go before symbolicating.
+        symbolicator = make_symbolicator(pid, memory);
+        sampler.detach();
     }
 
-    int status;
-    const pid_t waited_pid = wait(&status);
-    assert(pid == waited_pid);
+    if (capture) {
+        // Only libraries loaded while sampling are new by now.
+        capture->add_libraries(symbolicator->loaded_libraries());
+        capture->finish();
 
-    printf("Sampling completed.  Processing symbols...\n");
+        printf("Sampling completed.  Wrote %llu samples to %s.\n\n", (unsigned long long)capture->samples(), output_path.c_str());
+    } else {
+        printf("Sampling completed.  Processing symbols...\n");
 
-    FreeBSDSymbolicator symbolicator(pid);
-    process.print_tree(symbolicator);
+        if (!symbol_cache_directory.empty()) {
+            symbolicator->set_index_cache(&symbol_cache);
+        }
+
+        symbolicator->set_source_lines(source_lines);
 
-    printf("Binaries:\n");
-    symbolicator.print_libraries();
+        // With "mixed", LLDB gets only the addresses the native symbolicator can't place in a function.
+        std::unique_ptr<LLDBSymbolicator> lldb;
+
+        if (symbolicator_kind != SymbolicatorKind::native) {
+            lldb = std::make_unique<LLDBSymbolicator>(pid);
+        }
 
-    rv = ptrace(PT_DETACH, pid, (caddr_t)1, 0);
-    assert(!rv);
+        Symbolicator &backend = (symbolicator_kind == SymbolicatorKind::lldb) ? static_cast<Symbolicator &>(*lldb) : *symbolicator;
+        CachingSymbolicator symbols(backend);
 
-//    LLDBSymbolicator symbolicator(pid);
-//    process.print_tree(symbolicator);
+        if (symbolicator_kind == SymbolicatorKind::mixed) {
+            symbols.set_fallback(lldb.get());
+        }
+
+        export_profile(format, process, symbols, report_options, stdout);
+
+        printf("Binaries:\n");
+        symbolicator->print_libraries();
+        printf("\n");
+    }
+
+    if (agent) {
+        printf("Agent:\n");
+        agent->print_statistics();
+    } else {
+        printf("Sampling:\n");
+        scheduler.print_statistics();
+
+        printf("Overhead:\n");
+        overhead.print_statistics(syscalls);
+    }
 
     return 0;
 }
@@ -0,0 +1,164 @@
+//
+//  dwarf-reader.h
+//  drspin
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef DWARF_READER_H
+#define DWARF_READER_H
+
+// Pointer encodings (DW_EH_PE_*), from the LSB's description of .eh_frame.
+enum {
+    PE_ABSPTR = 0x00,
+    PE_ULEB128 = 0x01,
+    PE_UDATA2 = 0x02,
+    PE_UDATA4 = 0x03,
+    PE_UDATA8 = 0x04,
+    PE_SLEB128 = 0x09,
+    PE_SDATA2 = 0x0a,
+    PE_SDATA4 = 0x0b,
+    PE_SDATA8 = 0x0c,
+
+    PE_PCREL = 0x10,
+    PE_DATAREL = 0x30,
+    PE_INDIRECT = 0x80,
+    PE_OMIT = 0xff,
+};
+
+// Reads DWARF-encoded data (including .eh_frame) from a range of a mapped file, keeping track of the unslid address of the current position (for PC-relative pointers).  Reading past the end sets `error` and returns zeros rather than faulting, since the file is the target's and we don't trust it.
+struct DwarfReader {
+    const uint8_t *position;
+    const uint8_t *end;
+    uintptr_t address; // of `position`
+    bool error;
+
+    DwarfReader(const uint8_t *const start, const uint8_t *const end, const uintptr_t address)
+    : position(start), end(end), address(address), error(false) { }
+
+    template<typename T>
+    T fixed() {
+        T value = 0;
+
+        if ((size_t)(end - position) < sizeof (T)) {
+            error = true;
+        } else {
+            memcpy(&value, position, sizeof (T));
+            skip(sizeof (T));
+        }
+
+        return value;
+    }
+
+    uint64_t uleb128() {
+        uint64_t value = 0;
+
+        for (unsigned int shift = 0;; shift += 7) {
+            const uint8_t byte = fixed<uint8_t>();
+            if (error) return 0;
+            if (shift < 64) value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+
+        return value;
+    }
+
+    int64_t sleb128() {
+        uint64_t value = 0;
+        unsigned int shift = 0;
+        uint8_t byte;
+
+        do {
+            byte = fixed<uint8_t>();
+            if (error) return 0;
+            if (shift < 64) value |= (uint64_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (shift < 64 && (byte & 0x40)) {
+            value |= ~(uint64_t)0 << shift;
+        }
+
+        return (int64_t)value;
+    }
+
+    // Reads a pointer in the given DW_EH_PE_* encoding.  Indirect pointers aren't followed (they're only used for personality routines, which we skip).
+    uintptr_t pointer(const uint8_t encoding, const uintptr_t data_base) {
+        const uintptr_t field_address = address;
+        uintptr_t value;
+
+        switch (encoding & 0x0f) {
+            case PE_ABSPTR: value = fixed<uintptr_t>(); break;
+            case PE_ULEB128: value = (uintptr_t)uleb128(); break;
+            case PE_UDATA2: value = fixed<uint16_t>(); break;
+            case PE_UDATA4: value = fixed<uint32_t>(); break;
+            case PE_UDATA8: value = (uintptr_t)fixed<uint64_t>(); break;
+            case PE_SLEB128: value = (uintptr_t)sleb128(); break;
+            case PE_SDATA2: value = (uintptr_t)(intptr_t)fixed<int16_t>(); break;
+            case PE_SDATA4: value = (uintptr_t)(intptr_t)fixed<int32_t>(); break;
+            case PE_SDATA8: value = (uintptr_t)fixed<int64_t>(); break;
+            default: error = true; return 0;
+        }
+
+        switch (encoding & 0x70) {
+            case PE_ABSPTR: break;
+            case PE_PCREL: value += field_address; break;
+            case PE_DATAREL: value += data_base; break;
+            default: error = true; return 0;
+        }
+
+        return value;
+    }
+
+    void skip(const size_t count) {
+        if ((size_t)(end - position) < count) {
+            error = true;
+            position = end;
+        } else {
+            position += count;
+            address += count;
+        }
+    }
+
+    // Reads a NUL-terminated string.
+    const char *string() {
+        const char *const result = (const char *)position;
+        const size_t length = strnlen(result, end - position);
+
+        if (length == (size_t)(end - position)) {
+            error = true;
+            position = end;
+            return "";
+        }
+
+        skip(length + 1);
+        return result;
+    }
+
+    // Reads a section offset, which is 8 bytes in the 64-bit DWARF format and 4 in the 32-bit one.
+    uint64_t offset(const bool dwarf64) {
+        return dwarf64 ? fixed<uint64_t>() : fixed<uint32_t>();
+    }
+
+    // Reads an entry's (or unit's) initial length, and returns a reader for the rest of it, skipping past it.  Sets `dwarf64` (if it isn't null) to whether the entry is in the 64-bit DWARF format.
+    DwarfReader entry(bool *const dwarf64 = nullptr) {
+        uint64_t length = fixed<uint32_t>();
+        const bool is_dwarf64 = (length == 0xffffffff);
+        if (is_dwarf64) length = fixed<uint64_t>();
+        if (dwarf64 != nullptr) *dwarf64 = is_dwarf64;
+
+        if (error || length > (size_t)(end - position)) {
+            error = true;
+            return DwarfReader(end, end, address);
+        }
+
+        const DwarfReader result(position, position + length, address);
+        skip(length);
+
+        return result;
+    }
+};
+
+#endif /* DWARF_READER_H */
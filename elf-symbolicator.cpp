@@ -0,0 +1,556 @@
+//
+//  elf-symbolicator.cpp
+//  drspin
+//
+//  Created by Matt Jacobson on 6/7/22.
+//
+
+#include "elf-symbolicator.h"
+#include "elf-types.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cxxabi.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+bool is_elf(const char *const path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    char magic[SELFMAG];
+    const bool result = (read(fd, magic, SELFMAG) == SELFMAG && !memcmp(magic, ELFMAG, SELFMAG));
+    close(fd);
+
+    return result;
+}
+
+Library::Library(const std::string path, const uintptr_t load_address)
+: _path(path), _load_address(load_address), _base_address(0), _symbols_loaded(std::make_unique<std::once_flag>()), _unwind_table_built(std::make_unique<std::once_flag>()), _line_table_opened(std::make_unique<std::once_flag>()), _strtab(NULL), _strtab_size(0), _dynstrtab(NULL), _dynstrtab_size(0), _demangled_arena(std::make_unique<StringArena>()) {
+    if (path == "[vdso]") {
+        // There's no file to read.  Assume the vdso fits in a page.
+        _segments.emplace_back(load_address, load_address + getpagesize());
+        return;
+    }
+
+    // Read just the ELF header and program headers.
+    const int fd = open(path.c_str(), O_RDONLY);
+    assert(fd != -1);
+
+    Elf_Ehdr header;
+    ssize_t count = pread(fd, &header, sizeof (header), 0);
+    assert(count == sizeof (header));
+
+    std::vector<Elf_Phdr> phdrs(header.e_phnum);
+    count = pread(fd, phdrs.data(), phdrs.size() * sizeof (Elf_Phdr), header.e_phoff);
+    assert(count == (ssize_t)(phdrs.size() * sizeof (Elf_Phdr)));
+
+    // Look for a build ID in the notes.
+    for (const Elf_Phdr &phdr : phdrs) {
+        if (phdr.p_type != PT_NOTE || !_build_id.empty()) continue;
+
+        std::vector<char> notes(phdr.p_filesz);
+        count = pread(fd, notes.data(), notes.size(), phdr.p_offset);
+        if (count != (ssize_t)notes.size()) continue;
+
+        for (size_t offset = 0; offset + sizeof (Elf_Note) <= notes.size();) {
+            Elf_Note note;
+            memcpy(&note, &notes[offset], sizeof (note));
+
+            const size_t name_offset = offset + sizeof (note);
+            const size_t desc_offset = name_offset + ((note.n_namesz + 3) & ~3);
+            offset = desc_offset + ((note.n_descsz + 3) & ~3);
+            if (offset > notes.size()) break;
+
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && !memcmp(&notes[name_offset], "GNU", 4)) {
+                for (size_t i = 0; i < note.n_descsz; i++) {
+                    char hex[3];
+                    snprintf(hex, sizeof (hex), "%02x", (unsigned char)notes[desc_offset + i]);
+                    _build_id += hex;
+                }
+
+                break;
+            }
+        }
+    }
+
+    // Key the symbol index cache by build ID if we can, and otherwise by what we know about the file.
+    if (!_build_id.empty()) {
+        _cache_key = _build_id;
+    } else {
+        struct stat st;
+        const int rv = fstat(fd, &st);
+        assert(!rv);
+
+        uint64_t hash = hash_bytes(path.data(), path.size());
+        hash = hash_bytes(&st.st_size, sizeof (st.st_size), hash);
+        hash = hash_bytes(&st.st_mtime, sizeof (st.st_mtime), hash);
+
+        char key[24];
+        snprintf(key, sizeof (key), "p-%016llx", (unsigned long long)hash);
+        _cache_key = key;
+    }
+
+    close(fd);
+
+    // Get the unslid base address.
+    bool got_base_address = false;
+    for (const Elf_Phdr &phdr : phdrs) {
+        if (phdr.p_type == PT_LOAD) {
+            _base_address = (uintptr_t)phdr.p_vaddr;
+            got_base_address = true;
+            break;
+        }
+    }
+    assert(got_base_address);
+
+    for (const Elf_Phdr &phdr : phdrs) {
+        if (phdr.p_type == PT_LOAD) {
+            const uintptr_t start = load_address + (uintptr_t)phdr.p_vaddr - _base_address;
+            _segments.emplace_back(start, start + phdr.p_memsz);
+        }
+    }
+}
+
+void Library::load_symbols(const SymbolIndexCache *const cache) {
+    if (_path == "[vdso]") return;
+
+    bool mapped = false;
+
+    if (cache != nullptr) {
+        if (std::unique_ptr<const MappedFile> index = cache->find(_cache_key)) {
+            mapped = map_index(std::move(index));
+        }
+    }
+
+    if (!mapped) {
+        parse_symbols();
+
+        if (cache != nullptr) {
+            store_index(*cache);
+        }
+    }
+
+    _demangled_names = std::make_unique<std::atomic<const char *>[]>(_symbol_addresses.count());
+}
+
+void Library::parse_symbols() {
+    _file = std::make_unique<const MappedFile>(_path);
+    const MappedFile &file = *_file;
+    const Elf_Ehdr *const header = file.read<Elf_Ehdr>(0);
+
+    // Find the symbol tables and their associated string tables.
+    StaticUnownedArray<Elf_Sym> symtab, dynsymtab;
+
+    // Using the section names string table, walk the sections array.
+    const StaticUnownedArray<Elf_Shdr> sections = file.read_array<Elf_Shdr>(header->e_shoff, header->e_shnum);
+    const char *const shstrtab = file.read<char>(sections[header->e_shstrndx].sh_offset);
+
+    for (const Elf_Shdr &section : sections) {
+        if (section.sh_type == SHT_SYMTAB) {
+            symtab = file.read_array<Elf_Sym>(section.sh_offset, section.sh_size / sizeof (Elf_Sym));
+        } else if (section.sh_type == SHT_DYNSYM) {
+            dynsymtab = file.read_array<Elf_Sym>(section.sh_offset, section.sh_size / sizeof (Elf_Sym));
+        } else if (section.sh_type == SHT_STRTAB) {
+            const char *const name = shstrtab + section.sh_name;
+
+            if (!strcmp(name, ".strtab")) {
+                _strtab = file.read<char>(section.sh_offset);
+                _strtab_size = section.sh_size;
+            } else if (!strcmp(name, ".dynstr")) {
+                _dynstrtab = file.read<char>(section.sh_offset);
+                _dynstrtab_size = section.sh_size;
+            }
+        }
+    }
+
+    assert(symtab.count() == 0 || _strtab != NULL);
+    assert(dynsymtab.count() == 0 || _dynstrtab != NULL);
+
+    // Add symbols from both symbol tables.
+    std::vector<std::pair<uintptr_t, SymbolEntry>> symbols;
+    symbols.reserve(symtab.count() + dynsymtab.count());
+
+    for (const Elf_Sym &symbol : symtab) {
+        if (symbol.st_size > 0) {
+            symbols.push_back({ symbol.st_value, { .name = symbol.st_name, .size = (uint32_t)std::min(symbol.st_size, (decltype(symbol.st_size))INT32_MAX), .dynamic = 0 } });
+        }
+    }
+
+    for (const Elf_Sym &symbol : dynsymtab) {
+        if (symbol.st_size > 0) {
+            symbols.push_back({ symbol.st_value, { .name = symbol.st_name, .size = (uint32_t)std::min(symbol.st_size, (decltype(symbol.st_size))INT32_MAX), .dynamic = 1 } });
+        }
+    }
+
+    // TODO: add "artificial" symbols by parsing the PLT, like lldb does
+
+    // Most .dynsym entries are duplicated in .symtab, so keep just one symbol per address: the one from .symtab if there is one, and otherwise the largest.
+    std::sort(symbols.begin(), symbols.end(), [](const auto &a, const auto &b) {
+        if (a.first != b.first) return a.first < b.first;
+        if (a.second.dynamic != b.second.dynamic) return a.second.dynamic < b.second.dynamic;
+        return a.second.size > b.second.size;
+    });
+
+    symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const auto &a, const auto &b) {
+        return a.first == b.first;
+    }), symbols.end());
+
+    // Lay the sorted symbols out in Eytzinger order by walking the implicit tree in order.
+    const size_t count = symbols.size();
+    _parsed_addresses.resize(count + 1);
+    _parsed_entries.resize(count + 1);
+
+    size_t k = 1;
+    while (2 * k <= count) k *= 2;
+
+    for (const auto &[address, entry] : symbols) {
+        _parsed_addresses[k] = address;
+        _parsed_entries[k] = entry;
+
+        // Move to the in-order successor: the leftmost node of the right subtree if there is one, or else the nearest ancestor of which we're in the left subtree.
+        if (2 * k + 1 <= count) {
+            k = 2 * k + 1;
+            while (2 * k <= count) k *= 2;
+        } else {
+            while (k & 1) k >>= 1;
+            k >>= 1;
+        }
+    }
+
+    _symbol_addresses = StaticUnownedArray<uintptr_t>(_parsed_addresses.data(), _parsed_addresses.size());
+    _symbol_entries = StaticUnownedArray<SymbolEntry>(_parsed_entries.data(), _parsed_entries.size());
+}
+
+// A cached symbol index is this header, followed by the Eytzinger-ordered address and entry arrays, followed by copies of .strtab and .dynstr.
+struct SymbolIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint64_t count;
+    uint64_t strtab_size;
+    uint64_t dynstrtab_size;
+};
+
+const char symbol_index_magic[8] = { 'd', 'r', 's', 'p', 'i', 'n', 's', 'y' };
+const uint32_t symbol_index_version = 1;
+
+bool Library::map_index(std::unique_ptr<const MappedFile> index) {
+    const size_t file_size = index->size();
+    if (file_size < sizeof (SymbolIndexHeader)) return false;
+
+    const SymbolIndexHeader *const header = index->read<SymbolIndexHeader>(0);
+
+    if (memcmp(header->magic, symbol_index_magic, sizeof (symbol_index_magic)) || header->version != symbol_index_version || header->pointer_size != sizeof (uintptr_t)) {
+        return false;
+    }
+
+    // Bound each size by what's left of the file before doing any arithmetic with it, so that a damaged index can't make the offsets wrap around.
+    const size_t addresses_offset = sizeof (SymbolIndexHeader);
+    size_t remaining = file_size - addresses_offset;
+
+    if (header->count == 0 || header->count > remaining / (sizeof (uintptr_t) + sizeof (SymbolEntry))) {
+        return false;
+    }
+
+    remaining -= header->count * (sizeof (uintptr_t) + sizeof (SymbolEntry));
+
+    if (header->strtab_size > remaining || header->dynstrtab_size != remaining - header->strtab_size) {
+        return false;
+    }
+
+    const size_t entries_offset = addresses_offset + header->count * sizeof (uintptr_t);
+    const size_t strtab_offset = entries_offset + header->count * sizeof (SymbolEntry);
+    const size_t dynstrtab_offset = strtab_offset + header->strtab_size;
+
+    const StaticUnownedArray<uintptr_t> addresses = index->read_array<uintptr_t>(addresses_offset, header->count);
+    const StaticUnownedArray<SymbolEntry> entries = index->read_array<SymbolEntry>(entries_offset, header->count);
+    const char *const strtab = index->read<char>(strtab_offset);
+    const char *const dynstrtab = index->read<char>(dynstrtab_offset);
+
+    // Make sure a damaged index can't send us outside the file.
+    if ((header->strtab_size > 0 && strtab[header->strtab_size - 1] != '\0') || (header->dynstrtab_size > 0 && dynstrtab[header->dynstrtab_size - 1] != '\0')) {
+        return false;
+    }
+
+    for (size_t i = 1; i < entries.count(); i++) {
+        if (entries[i].name >= (entries[i].dynamic ? header->dynstrtab_size : header->strtab_size)) {
+            return false;
+        }
+    }
+
+    _symbol_addresses = addresses;
+    _symbol_entries = entries;
+    _strtab = strtab;
+    _strtab_size = header->strtab_size;
+    _dynstrtab = dynstrtab;
+    _dynstrtab_size = header->dynstrtab_size;
+    _file = std::move(index);
+
+    return true;
+}
+
+void Library::store_index(const SymbolIndexCache &cache) const {
+    SymbolIndexHeader header = {
+        .version = symbol_index_version,
+        .pointer_size = sizeof (uintptr_t),
+        .count = _symbol_addresses.count(),
+        .strtab_size = _strtab_size,
+        .dynstrtab_size = _dynstrtab_size,
+    };
+    memcpy(header.magic, symbol_index_magic, sizeof (header.magic));
+
+    cache.store(_cache_key, {
+        { &header, sizeof (header) },
+        { _symbol_addresses.begin(), _symbol_addresses.count() * sizeof (uintptr_t) },
+        { _symbol_entries.begin(), _symbol_entries.count() * sizeof (SymbolEntry) },
+        { _strtab, _strtab_size },
+        { _dynstrtab, _dynstrtab_size },
+    });
+}
+
+size_t Library::find_symbol(const uintptr_t address) const {
+    const size_t count = _symbol_addresses.count() > 0 ? _symbol_addresses.count() - 1 : 0;
+    size_t best = 0;
+
+    for (size_t k = 1; k <= count;) {
+        const bool not_greater = (_symbol_addresses[k] <= address);
+        best = not_greater ? k : best;
+        k = 2 * k + not_greater;
+    }
+
+    return best;
+}
+
+const char *Library::symbol_name(const SymbolEntry &entry) const {
+    return (entry.dynamic ? _dynstrtab : _strtab) + entry.name;
+}
+
+const char *Library::function_name(const size_t index) {
+    std::atomic<const char *> &slot = _demangled_names[index];
+    const char *name = slot.load(std::memory_order_acquire);
+    if (name != nullptr) return name;
+
+    // Only C++ names are mangled (with the Itanium ABI's "_Z" prefix); any other name is used straight from the string table.
+    name = symbol_name(_symbol_entries[index]);
+
+    if (!strncmp(name, "_Z", 2)) {
+        int status;
+        char *const demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+
+        if (status == 0) {
+            name = _demangled_arena->copy(demangled);
+        }
+
+        free(demangled);
+    }
+
+    // Two threads may race to demangle the same symbol, in which case one copy goes to waste.
+    slot.store(name, std::memory_order_release);
+    return name;
+}
+
+Symbol Library::symbolicate(const uintptr_t address, const SymbolIndexCache *const cache, const bool lines) {
+    std::call_once(*_symbols_loaded, &Library::load_symbols, this, cache);
+
+    Symbol result;
+    result.library = name();
+
+    const size_t index = find_symbol(address);
+
+    if (index != 0) {
+        const SymbolEntry &entry = _symbol_entries[index];
+        const uintptr_t offset = address - _symbol_addresses[index];
+
+        if (offset < entry.size) {
+            result.function = function_name(index);
+            result.description = result.function + " + " + std::to_string(offset);
+        }
+    }
+
+    if (result.description.empty()) {
+        result.description = "???";
+    }
+
+    result.description += " (in ";
+    result.description += result.library;
+    result.description += ")";
+
+    const char *file;
+    unsigned int line;
+
+    if (lines && line_table().find(address, file, line)) {
+        result.file = file;
+        result.line = line;
+    }
+
+    return result;
+}
+
+std::string Library::path() const {
+    return _path;
+}
+
+std::string Library::name() const {
+    return std::filesystem::path(_path).filename().string();
+}
+
+uintptr_t Library::load_address() const {
+    return _load_address;
+}
+
+uintptr_t Library::base_address() const {
+    return _base_address;
+}
+
+const std::vector<Library::Range> &Library::segments() const {
+    return _segments;
+}
+
+std::string Library::build_id() const {
+    return _build_id;
+}
+
+void Library::build_unwind_table() {
+    if (_path == "[vdso]") {
+        _unwind_table = std::make_unique<const UnwindTable>();
+    } else {
+        // The table is self-contained, so the file needn't stay mapped.
+        const MappedFile file(_path);
+        _unwind_table = std::make_unique<const UnwindTable>(file, _base_address);
+    }
+}
+
+const UnwindTable &Library::unwind_table() {
+    std::call_once(*_unwind_table_built, &Library::build_unwind_table, this);
+    return *_unwind_table;
+}
+
+void Library::adopt_unwind_table(Library &other) {
+    if (!other._unwind_table) return;
+
+    std::call_once(*_unwind_table_built, [this, &other]() {
+        _unwind_table = std::move(other._unwind_table);
+    });
+}
+
+void Library::open_line_table() {
+    // The vDSO has no file (and no debug info).
+    _line_table = std::make_unique<LineTable>(_path == "[vdso]" ? "" : _path, _build_id);
+}
+
+LineTable &Library::line_table() {
+    std::call_once(*_line_table_opened, &Library::open_line_table, this);
+    return *_line_table;
+}
+
+ELFSymbolicator::ELFSymbolicator()
+: _index_cache(nullptr), _source_lines(false) { }
+
+void ELFSymbolicator::set_index_cache(const SymbolIndexCache *const cache) {
+    _index_cache = cache;
+}
+
+void ELFSymbolicator::set_source_lines(const bool source_lines) {
+    _source_lines = source_lines;
+}
+
+const Library &ELFSymbolicator::add_library(const std::string path, const uintptr_t load_address) {
+    const size_t library_index = _libraries.size();
+    const Library &library = _libraries.emplace_back(path, load_address);
+
+    for (const auto &[start, end] : library.segments()) {
+        const Segment segment = { .start = start, .end = end, .library_index = library_index };
+        const auto position = std::upper_bound(_segments.begin(), _segments.end(), segment, [](const Segment &a, const Segment &b) {
+            return a.start < b.start;
+        });
+
+        _segments.insert(position, segment);
+    }
+
+    return library;
+}
+
+Library *ELFSymbolicator::find_library(const uintptr_t address) {
+    // upper_bound() returns the first segment *starting after* the supplied address (or end() if none).
+    auto iter = std::upper_bound(_segments.begin(), _segments.end(), address,
+                                 [](const uintptr_t address, const Segment &segment) {
+        return address < segment.start;
+    });
+
+    if (iter != _segments.begin() && address < (iter - 1)->end) {
+        return &_libraries[(iter - 1)->library_index];
+    } else {
+        return nullptr;
+    }
+}
+
+Symbol ELFSymbolicator::symbolicate(const uintptr_t address) {
+    if (address == 0) return { .description = "...", .function = "...", .library = "" };
+
+    if (Library *const library = find_library(address)) {
+        return library->symbolicate(library->base_address() + address - library->load_address(), _index_cache, _source_lines);
+    } else {
+        return { .description = "???", .function = "", .library = "" };
+    }
+}
+
+std::vector<Symbol> ELFSymbolicator::symbolicate_batch(const std::vector<uintptr_t> &addresses) {
+    std::vector<Symbol> symbols(addresses.size());
+
+    // Lookups only read the libraries (whose symbols are loaded at most once, under a std::once_flag), so they can run in parallel.
+    parallel_for(addresses.size(), 256, [&](const size_t i) {
+        symbols[i] = symbolicate(addresses[i]);
+    });
+
+    return symbols;
+}
+
+void ELFSymbolicator::build_unwind_tables() {
+    // Each library's table is built at most once, under its std::once_flag, and independently of the others.
+    parallel_for(_libraries.size(), 1, [this](const size_t i) {
+        _libraries[i].unwind_table();
+    });
+}
+
+void ELFSymbolicator::adopt_unwind_tables(ELFSymbolicator &previous) {
+    for (Library &library : _libraries) {
+        for (Library &old : previous._libraries) {
+            if (old.path() == library.path() && old.load_address() == library.load_address() && old.build_id() == library.build_id()) {
+                library.adopt_unwind_table(old);
+                break;
+            }
+        }
+    }
+}
+
+const UnwindTable::Rule *ELFSymbolicator::unwind_rule(const uintptr_t address) {
+    Library *const library = find_library(address);
+    if (library == nullptr) return nullptr;
+
+    return library->unwind_table().find(library->base_address() + address - library->load_address());
+}
+
+std::vector<LoadedLibrary> ELFSymbolicator::loaded_libraries() const {
+    std::vector<LoadedLibrary> libraries;
+
+    for (const Library &library : _libraries) {
+        libraries.push_back({ .path = library.path(), .load_address = library.load_address(), .build_id = library.build_id() });
+    }
+
+    return libraries;
+}
+
+void ELFSymbolicator::print_libraries() const {
+    for (const Library &library : _libraries) {
+        printf("%#18lx  %s\n", library.load_address(), library.path().c_str());
+    }
+}
@@ -0,0 +1,162 @@
+//
+//  elf-symbolicator.h
+//  drspin
+//
+//  Created by Matt Jacobson on 6/7/22.
+//
+
+#include "line-table.h"
+#include "symbol-cache.h"
+#include "unwind-table.h"
+#include "util.h"
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef ELF_SYMBOLICATOR_H
+#define ELF_SYMBOLICATOR_H
+
+// Whether the file at `path` exists and is an ELF object.
+bool is_elf(const char *path);
+
+// What we record about a library to find it again later: see CaptureWriter.
+struct LoadedLibrary {
+    std::string path;
+    uintptr_t load_address;
+    std::string build_id;
+
+    bool operator==(const LoadedLibrary &other) const {
+        return path == other.path && load_address == other.load_address && build_id == other.build_id;
+    }
+};
+
+// A loaded ELF object.  Only its program headers are read up front; its symbol tables are parsed the first time an address in it is symbolicated, since a typical profile only touches a handful of the objects a process has loaded.
+struct Library {
+    using Range = std::pair<uintptr_t, uintptr_t>;
+
+    Library(std::string path, uintptr_t load_address);
+
+    // Symbolicates an unslid address, loading the library's symbols (through `cache`, if it's not null) if necessary.  If `lines`, also looks up its source line.  Safe to call concurrently.
+    Symbol symbolicate(uintptr_t address, const SymbolIndexCache *cache, bool lines);
+
+    std::string path() const;
+    std::string name() const;
+    uintptr_t load_address() const;
+    uintptr_t base_address() const;
+
+    // The (slid) address ranges of the library's PT_LOAD segments.
+    const std::vector<Range> &segments() const;
+
+    // The object's build ID note, in hex, or the empty string if it doesn't have one.
+    std::string build_id() const;
+
+    // The object's compiled CFI, which is built the first time it's needed.  Safe to call concurrently.
+    const UnwindTable &unwind_table();
+
+    // Takes `other`'s compiled CFI, if it has been built and this library's hasn't, rather than building it again.  `other` must be the same object, loaded at the same address.
+    void adopt_unwind_table(Library &other);
+
+    // The object's line table, which is opened the first time it's needed.  Safe to call concurrently.
+    LineTable &line_table();
+private:
+    void build_unwind_table();
+    void open_line_table();
+    void load_symbols(const SymbolIndexCache *cache);
+    void parse_symbols();
+    bool map_index(std::unique_ptr<const MappedFile> index);
+    void store_index(const SymbolIndexCache &cache) const;
+
+    // Symbol names aren't copied out of the file: each symbol is just an address plus one of these, whose name is an offset into one of the file's string tables.
+    struct SymbolEntry {
+        uint32_t name;
+        uint32_t size : 31;
+        uint32_t dynamic : 1; // whether `name` is in .dynstr rather than .strtab
+    };
+
+    // Returns the index of the symbol with the greatest address not greater than `address`, or 0 if there isn't one.
+    size_t find_symbol(uintptr_t address) const;
+
+    const char *symbol_name(const SymbolEntry &entry) const;
+
+    // The demangled name of the symbol at `index`.  Names are demangled the first time they're needed, since a report usually shows only a small fraction of a library's symbols.
+    const char *function_name(size_t index);
+
+    std::string _path;
+    uintptr_t _load_address;
+    uintptr_t _base_address;
+    std::vector<Range> _segments;
+    std::string _build_id;
+    std::string _cache_key;
+    std::unique_ptr<std::once_flag> _symbols_loaded;
+    std::unique_ptr<std::once_flag> _unwind_table_built;
+    std::unique_ptr<const UnwindTable> _unwind_table;
+    std::unique_ptr<std::once_flag> _line_table_opened;
+    std::unique_ptr<LineTable> _line_table;
+
+    // The file (either the object itself or its cached index) stays mapped for as long as the library exists, so that symbol names can point into it.
+    std::unique_ptr<const MappedFile> _file;
+    const char *_strtab;
+    size_t _strtab_size;
+    const char *_dynstrtab;
+    size_t _dynstrtab_size;
+
+    // The symbols' addresses, in Eytzinger (breadth-first binary tree) order, starting at index 1, with the corresponding entries at the same indices.  Searching this layout touches far fewer cache lines than a binary search of a sorted array.
+    //
+    // These point either into the vectors below (if we parsed the object) or into a cached index.
+    StaticUnownedArray<uintptr_t> _symbol_addresses;
+    StaticUnownedArray<SymbolEntry> _symbol_entries;
+    std::vector<uintptr_t> _parsed_addresses;
+    std::vector<SymbolEntry> _parsed_entries;
+
+    // Each symbol's demangled name (at the same index as its address), or null if it hasn't been needed yet.  Names that needed demangling live in the arena; the rest point into the string tables.
+    std::unique_ptr<std::atomic<const char *>[]> _demangled_names;
+    std::unique_ptr<StringArena> _demangled_arena;
+};
+
+// Symbolicates addresses by parsing the ELF symbol tables of a set of libraries.  Subclasses are responsible for finding the libraries.
+struct ELFSymbolicator : public Symbolicator {
+    ELFSymbolicator();
+    Symbol symbolicate(uintptr_t address);
+    std::vector<Symbol> symbolicate_batch(const std::vector<uintptr_t> &addresses);
+    void print_libraries() const;
+    std::vector<LoadedLibrary> loaded_libraries() const;
+
+    // Use prebuilt symbol indexes from (and save new ones to) `cache`.  Must be called before symbolicating anything.
+    void set_index_cache(const SymbolIndexCache *cache);
+
+    // Also look up each address's source file and line, from the libraries' DWARF line tables.
+    void set_source_lines(bool source_lines);
+
+    // Builds every library's unwind table now, in parallel, rather than the first time an address in it is unwound (which would be while the target is stopped for a sample).  Tables already built (or adopted) aren't built again.
+    void build_unwind_tables();
+
+    // Takes the unwind tables `previous` has built for libraries that are also in this symbolicator, so that only newly loaded libraries need building.
+    void adopt_unwind_tables(ELFSymbolicator &previous);
+
+    // Returns the unwind rule for a (slid) address, or null if it isn't in a library or its library has no rule for it.
+    const UnwindTable::Rule *unwind_rule(uintptr_t address);
+protected:
+    const Library &add_library(std::string path, uintptr_t load_address);
+private:
+    // Returns the library containing an address, or null if there isn't one.
+    Library *find_library(uintptr_t address);
+
+    struct Segment {
+        uintptr_t start;
+        uintptr_t end;
+        size_t library_index;
+    };
+
+    std::vector<Library> _libraries;
+    const SymbolIndexCache *_index_cache;
+    bool _source_lines;
+
+    // Every library's segments, sorted by address.
+    std::vector<Segment> _segments;
+};
+
+#endif /* ELF_SYMBOLICATOR_H */
@@ -0,0 +1,26 @@
+//
+//  elf-types.h
+//  drspin
+//
+
+#if defined(__FreeBSD__)
+#include <sys/elf.h>
+#elif defined(__linux__)
+#include <elf.h>
+#include <link.h>
+#endif
+
+#ifndef ELF_TYPES_H
+#define ELF_TYPES_H
+
+#if defined(__linux__)
+// FreeBSD's <sys/elf.h> provides word-size-agnostic names for the ELF types; glibc only has the ElfW() macro.
+typedef ElfW(Ehdr) Elf_Ehdr;
+typedef ElfW(Phdr) Elf_Phdr;
+typedef ElfW(Shdr) Elf_Shdr;
+typedef ElfW(Sym) Elf_Sym;
+typedef ElfW(Dyn) Elf_Dyn;
+typedef ElfW(Nhdr) Elf_Note;
+#endif /* __linux__ */
+
+#endif /* ELF_TYPES_H */
@@ -0,0 +1,573 @@
+//
+//  exporters.cpp
+//  drspin
+//
+
+#include "exporters.h"
+#include "function-table.h"
+#include "stack-trie.h"
+#include "timeline.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+OutputBuffer::OutputBuffer(FILE *const file)
+: _file(file) {
+    _buffer.reserve(capacity);
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::append(const char *const data, const size_t size) {
+    if (_buffer.size() + size > capacity) {
+        flush();
+    }
+
+    _buffer.append(data, size);
+}
+
+void OutputBuffer::append(const std::string &string) {
+    append(string.data(), string.size());
+}
+
+void OutputBuffer::append(const char character) {
+    append(&character, 1);
+}
+
+void OutputBuffer::append_decimal(const uint64_t value) {
+    char digits[20];
+    const auto result = std::to_chars(digits, digits + sizeof (digits), value);
+    append(digits, result.ptr - digits);
+}
+
+void OutputBuffer::flush() {
+    fwrite(_buffer.data(), 1, _buffer.size(), _file);
+    _buffer.clear();
+}
+
+bool parse_export_format(const char *const name, ExportFormat &format) {
+    if (!strcmp(name, "text")) {
+        format = ExportFormat::text;
+    } else if (!strcmp(name, "bottom-up")) {
+        format = ExportFormat::bottom_up;
+    } else if (!strcmp(name, "top")) {
+        format = ExportFormat::top;
+    } else if (!strcmp(name, "collapsed")) {
+        format = ExportFormat::collapsed;
+    } else if (!strcmp(name, "pprof")) {
+        format = ExportFormat::pprof;
+    } else if (!strcmp(name, "speedscope")) {
+        format = ExportFormat::speedscope;
+    } else if (!strcmp(name, "trace")) {
+        format = ExportFormat::trace;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void export_profile(const ExportFormat format, const Process &process, Symbolicator &symbolicator, const ReportOptions &options, FILE *const file) {
+    switch (format) {
+        case ExportFormat::text:
+            process.print_tree(symbolicator, options, file);
+            break;
+        case ExportFormat::bottom_up:
+            process.print_functions(symbolicator, options, true, file);
+            break;
+        case ExportFormat::top:
+            process.print_functions(symbolicator, options, false, file);
+            break;
+        case ExportFormat::collapsed:
+            export_collapsed(process, symbolicator, options.filter, file);
+            break;
+        case ExportFormat::pprof:
+            export_pprof(process, symbolicator, options.filter, file);
+            break;
+        case ExportFormat::speedscope:
+            export_speedscope(process, symbolicator, options.filter, file);
+            break;
+        case ExportFormat::trace:
+            export_trace(process, symbolicator, options.filter, file);
+            break;
+    }
+}
+
+static std::string thread_name(const Thread &thread) {
+    char name[32];
+    snprintf(name, sizeof (name), "Thread %#x", thread.lwpid);
+    return name;
+}
+
+// The subset of the protocol buffer wire format that profile.proto needs.
+enum WireType {
+    WIRE_VARINT = 0,
+    WIRE_LENGTH_DELIMITED = 2,
+};
+
+static void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+
+    out += (char)value;
+}
+
+static void put_tag(std::string &out, const unsigned int field, const WireType type) {
+    put_varint(out, (field << 3) | type);
+}
+
+static void put_uint_field(std::string &out, const unsigned int field, const uint64_t value) {
+    put_tag(out, field, WIRE_VARINT);
+    put_varint(out, value);
+}
+
+static void put_bytes_field(std::string &out, const unsigned int field, const char *const bytes, const size_t size) {
+    put_tag(out, field, WIRE_LENGTH_DELIMITED);
+    put_varint(out, size);
+    out.append(bytes, size);
+}
+
+static void put_bytes_field(std::string &out, const unsigned int field, const std::string &bytes) {
+    put_bytes_field(out, field, bytes.data(), bytes.size());
+}
+
+// pprof refers to every string by its index in the profile's string table, whose first entry must be empty.
+struct StringTable {
+    StringTable()
+    : _strings({ "" }) {
+        _indexes.emplace("", 0);
+    }
+
+    uint64_t intern(const std::string &string) {
+        const auto [entry, inserted] = _indexes.try_emplace(string, _strings.size());
+
+        if (inserted) {
+            _strings.push_back(string);
+        }
+
+        return entry->second;
+    }
+
+    const std::vector<std::string> &strings() const {
+        return _strings;
+    }
+private:
+    std::vector<std::string> _strings;
+    std::unordered_map<std::string, uint64_t> _indexes;
+};
+
+static void append_json_string(OutputBuffer &out, const std::string &string) {
+    out.append('"');
+
+    for (const char character : string) {
+        if (character == '"' || character == '\\') {
+            out.append('\\');
+            out.append(character);
+        } else if ((unsigned char)character < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof (escape), "\\u%04x", character);
+            out.append(escape, 6);
+        } else {
+            out.append(character);
+        }
+    }
+
+    out.append('"');
+}
+
+// Appends a time in nanoseconds as microseconds, the unit of trace event timestamps.
+static void append_microseconds(OutputBuffer &out, const uint64_t nanoseconds) {
+    char fraction[8];
+    snprintf(fraction, sizeof (fraction), ".%03u", (unsigned int)(nanoseconds % 1000));
+
+    out.append_decimal(nanoseconds / 1000);
+    out.append(fraction, 4);
+}
+
+void export_collapsed(const Process &process, Symbolicator &symbolicator, const SampleFilter filter, FILE *const file) {
+    const FunctionTable table(process.stacks(), symbolicator);
+    OutputBuffer out(file);
+
+    // Semicolons separate frames, so they can't appear in names.
+    std::vector<std::string> names;
+
+    for (const FunctionTable::Function &function : table.functions) {
+        std::string &name = names.emplace_back(function.name);
+        std::replace(name.begin(), name.end(), ';', ':');
+    }
+
+    std::vector<uintptr_t> frames;
+
+    for (const Thread &thread : process.threads()) {
+        const std::string thread_frame = thread_name(thread);
+
+        for (const auto [stack, count] : thread.counts(filter)) {
+            process.stacks().frames(stack, frames);
+            out.append(thread_frame);
+
+            for (const uintptr_t address : frames) {
+                out.append(';');
+                out.append(names[table.function(address)]);
+            }
+
+            out.append(' ');
+            out.append_decimal(count);
+            out.append('\n');
+        }
+    }
+}
+
+void export_pprof(const Process &process, Symbolicator &symbolicator, const SampleFilter filter, FILE *const file) {
+    // Field numbers from profile.proto.
+    enum {
+        PROFILE_SAMPLE_TYPE = 1,
+        PROFILE_SAMPLE = 2,
+        PROFILE_LOCATION = 4,
+        PROFILE_FUNCTION = 5,
+        PROFILE_STRING_TABLE = 6,
+        VALUE_TYPE_TYPE = 1,
+        VALUE_TYPE_UNIT = 2,
+        SAMPLE_LOCATION_ID = 1,
+        SAMPLE_VALUE = 2,
+        SAMPLE_LABEL = 3,
+        LABEL_KEY = 1,
+        LABEL_NUM = 3,
+        LOCATION_ID = 1,
+        LOCATION_ADDRESS = 3,
+        LOCATION_LINE = 4,
+        LINE_FUNCTION_ID = 1,
+        LINE_LINE = 2,
+        FUNCTION_ID = 1,
+        FUNCTION_NAME = 2,
+        FUNCTION_SYSTEM_NAME = 3,
+        FUNCTION_FILENAME = 4,
+        FUNCTION_START_LINE = 5,
+    };
+
+    const FunctionTable table(process.stacks(), symbolicator);
+    OutputBuffer out(file);
+    StringTable strings;
+
+    // The fields of a message can come in any order, so each sample, location, and function is written as soon as it's encoded, and only the string table waits until the end.
+    std::string message, submessage, field;
+
+    const auto write_field = [&out, &field](const unsigned int number, const std::string &bytes) {
+        field.clear();
+        put_bytes_field(field, number, bytes);
+        out.append(field);
+    };
+
+    message.clear();
+    put_uint_field(message, VALUE_TYPE_TYPE, strings.intern("samples"));
+    put_uint_field(message, VALUE_TYPE_UNIT, strings.intern("count"));
+    write_field(PROFILE_SAMPLE_TYPE, message);
+
+    message.clear();
+    put_uint_field(message, VALUE_TYPE_TYPE, strings.intern("cpu"));
+    put_uint_field(message, VALUE_TYPE_UNIT, strings.intern("nanoseconds"));
+    write_field(PROFILE_SAMPLE_TYPE, message);
+
+    const uint64_t thread_key = strings.intern("thread");
+    std::vector<uintptr_t> frames;
+
+    // Location IDs are 1-based indexes into the (sorted) addresses.
+    const auto location_id = [&table](const uintptr_t address) {
+        return std::lower_bound(table.addresses.begin(), table.addresses.end(), address) - table.addresses.begin() + 1;
+    };
+
+    for (const Thread &thread : process.threads()) {
+        for (const auto [stack, count] : thread.counts(filter)) {
+            process.stacks().frames(stack, frames);
+
+            // Locations are listed leaf first.
+            submessage.clear();
+            for (auto iter = frames.rbegin(); iter != frames.rend(); iter++) {
+                put_varint(submessage, location_id(*iter));
+            }
+
+            message.clear();
+            put_bytes_field(message, SAMPLE_LOCATION_ID, submessage);
+
+            submessage.clear();
+            put_varint(submessage, count);
+            put_varint(submessage, thread.cpu_time(stack, filter));
+            put_bytes_field(message, SAMPLE_VALUE, submessage);
+
+            submessage.clear();
+            put_uint_field(submessage, LABEL_KEY, thread_key);
+            put_uint_field(submessage, LABEL_NUM, thread.lwpid);
+            put_bytes_field(message, SAMPLE_LABEL, submessage);
+
+            write_field(PROFILE_SAMPLE, message);
+        }
+    }
+
+    for (size_t i = 0; i < table.addresses.size(); i++) {
+        submessage.clear();
+        put_uint_field(submessage, LINE_FUNCTION_ID, table.function(table.addresses[i]) + 1);
+
+        if (const unsigned int line = table.symbol(table.addresses[i]).line) {
+            put_uint_field(submessage, LINE_LINE, line);
+        }
+
+        message.clear();
+        put_uint_field(message, LOCATION_ID, i + 1);
+        put_uint_field(message, LOCATION_ADDRESS, table.addresses[i]);
+        put_bytes_field(message, LOCATION_LINE, submessage);
+        write_field(PROFILE_LOCATION, message);
+    }
+
+    for (size_t i = 0; i < table.functions.size(); i++) {
+        const FunctionTable::Function &function = table.functions[i];
+        const uint64_t name = strings.intern(function.name);
+
+        // Without a source file, the library is the best "file" we have.
+        message.clear();
+        put_uint_field(message, FUNCTION_ID, i + 1);
+        put_uint_field(message, FUNCTION_NAME, name);
+        put_uint_field(message, FUNCTION_SYSTEM_NAME, name);
+        put_uint_field(message, FUNCTION_FILENAME, strings.intern(function.file.empty() ? function.library : function.file));
+
+        if (function.line != 0) {
+            put_uint_field(message, FUNCTION_START_LINE, function.line);
+        }
+
+        write_field(PROFILE_FUNCTION, message);
+    }
+
+    for (const std::string &string : strings.strings()) {
+        write_field(PROFILE_STRING_TABLE, string);
+    }
+}
+
+void export_speedscope(const Process &process, Symbolicator &symbolicator, const SampleFilter filter, FILE *const file) {
+    const FunctionTable table(process.stacks(), symbolicator);
+    OutputBuffer out(file);
+
+    out.append("{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\",\"exporter\":\"drspin\",\"name\":");
+    append_json_string(out, std::string(process.name()) + " [" + std::to_string(process.pid()) + "]");
+    out.append(",\"activeProfileIndex\":0,\"shared\":{\"frames\":[");
+
+    for (size_t i = 0; i < table.functions.size(); i++) {
+        if (i > 0) out.append(',');
+
+        const FunctionTable::Function &function = table.functions[i];
+
+        out.append("{\"name\":");
+        append_json_string(out, function.name);
+        out.append(",\"file\":");
+        append_json_string(out, function.file.empty() ? function.library : function.file);
+
+        if (function.line != 0) {
+            out.append(",\"line\":");
+            out.append_decimal(function.line);
+        }
+
+        out.append('}');
+    }
+
+    out.append("]},\"profiles\":[");
+    std::vector<uintptr_t> frames;
+    bool first_thread = true;
+
+    for (const Thread &thread : process.threads()) {
+        uint64_t total = 0;
+        for (const auto [stack, count] : thread.counts(filter)) total += count;
+
+        if (!first_thread) out.append(',');
+        first_thread = false;
+
+        out.append("{\"type\":\"sampled\",\"name\":");
+        append_json_string(out, thread_name(thread));
+        out.append(",\"unit\":\"none\",\"startValue\":0,\"endValue\":");
+        out.append_decimal(total);
+
+        // Stacks are listed root first.
+        out.append(",\"samples\":[");
+        bool first_stack = true;
+
+        for (const auto [stack, count] : thread.counts(filter)) {
+            process.stacks().frames(stack, frames);
+
+            if (!first_stack) out.append(',');
+            first_stack = false;
+
+            out.append('[');
+            for (size_t i = 0; i < frames.size(); i++) {
+                if (i > 0) out.append(',');
+                out.append_decimal(table.function(frames[i]));
+            }
+            out.append(']');
+        }
+
+        // Weights are in the same order as the samples, since iterating an unchanged map always visits it in the same order.
+        out.append("],\"weights\":[");
+        first_stack = true;
+
+        for (const auto [stack, count] : thread.counts(filter)) {
+            if (!first_stack) out.append(',');
+            first_stack = false;
+
+            out.append_decimal(count);
+        }
+
+        out.append("]}");
+    }
+
+    out.append("]}\n");
+}
+
+void export_trace(const Process &process, Symbolicator &symbolicator, const SampleFilter filter, FILE *const file) {
+    const FunctionTable table(process.stacks(), symbolicator);
+    OutputBuffer out(file);
+
+    // Times are relative to the first sample.
+    uint64_t start = UINT64_MAX;
+
+    for (const Thread &thread : process.threads()) {
+        Timeline::Cursor cursor(thread.timeline());
+        Timeline::Sample sample;
+
+        if (cursor.next(sample)) {
+            start = std::min(start, sample.timestamp);
+        }
+    }
+
+    const std::string pid = std::to_string(process.pid());
+
+    out.append("{\"otherData\":{\"exporter\":\"drspin\"},\"traceEvents\":[{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":");
+    out.append(pid);
+    out.append(",\"tid\":0,\"args\":{\"name\":");
+    append_json_string(out, process.name());
+    out.append("}}");
+
+    std::vector<uintptr_t> frames;
+    std::vector<size_t> functions;
+    std::vector<size_t> open; // the functions with open spans, outermost first
+    std::vector<uint64_t> intervals;
+
+    for (const Thread &thread : process.threads()) {
+        if (thread.timeline().size() == 0) continue;
+
+        const std::string tid = std::to_string(thread.lwpid);
+
+        out.append(",{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":");
+        out.append(pid);
+        out.append(",\"tid\":");
+        out.append(tid);
+        out.append(",\"args\":{\"name\":");
+        append_json_string(out, thread_name(thread));
+        out.append("}}");
+
+        // A sample stands for the time until the thread's next one, unless that's much longer than usual (e.g., the thread was idle and the agent didn't sample it, or drspin fell behind), in which case it stands for a typical interval.
+        Timeline::Sample sample;
+        intervals.clear();
+
+        {
+            Timeline::Cursor cursor(thread.timeline());
+            uint64_t last_timestamp = UINT64_MAX;
+
+            while (cursor.next(sample)) {
+                if (last_timestamp != UINT64_MAX && sample.timestamp > last_timestamp) {
+                    intervals.push_back(sample.timestamp - last_timestamp);
+                }
+
+                last_timestamp = sample.timestamp;
+            }
+        }
+
+        uint64_t typical_interval = 0;
+
+        if (!intervals.empty()) {
+            std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2, intervals.end());
+            typical_interval = intervals[intervals.size() / 2];
+        }
+
+        // Ends the spans of all but the outermost `depth` open functions, and begins spans for `functions` beyond them.
+        const auto transition = [&](const uint64_t timestamp, const size_t depth) {
+            while (open.size() > depth) {
+                open.pop_back();
+
+                out.append(",{\"ph\":\"E\",\"pid\":");
+                out.append(pid);
+                out.append(",\"tid\":");
+                out.append(tid);
+                out.append(",\"ts\":");
+                append_microseconds(out, timestamp - start);
+                out.append('}');
+            }
+
+            for (size_t i = depth; i < functions.size(); i++) {
+                const FunctionTable::Function &function = table.functions[functions[i]];
+                open.push_back(functions[i]);
+
+                out.append(",{\"ph\":\"B\",\"pid\":");
+                out.append(pid);
+                out.append(",\"tid\":");
+                out.append(tid);
+                out.append(",\"ts\":");
+                append_microseconds(out, timestamp - start);
+                out.append(",\"name\":");
+                append_json_string(out, function.name);
+                out.append(",\"cat\":");
+                append_json_string(out, function.library);
+                out.append('}');
+            }
+        };
+
+        Timeline::Cursor cursor(thread.timeline());
+        StackTrie::NodeID open_stack = StackTrie::none;
+        uint64_t last_timestamp = 0;
+        open.clear();
+
+        while (cursor.next(sample)) {
+            const bool selected = (filter == SampleFilter::all) || (sample.on_cpu == (filter == SampleFilter::on_cpu));
+
+            // Close everything over a gap.
+            if (open_stack != StackTrie::none && sample.timestamp - last_timestamp > 4 * typical_interval) {
+                functions.clear();
+                transition(last_timestamp + typical_interval, 0);
+                open_stack = StackTrie::none;
+            }
+
+            last_timestamp = sample.timestamp;
+
+            // Consecutive samples of the same stack (or of stacks that differ only in offsets) make one span.
+            const StackTrie::NodeID stack = selected ? sample.stack : StackTrie::none;
+            if (stack == open_stack) continue;
+
+            functions.clear();
+
+            if (stack != StackTrie::none) {
+                process.stacks().frames(stack, frames);
+
+                for (const uintptr_t address : frames) {
+                    functions.push_back(table.function(address));
+                }
+            }
+
+            size_t common = 0;
+            while (common < open.size() && common < functions.size() && open[common] == functions[common]) {
+                common++;
+            }
+
+            transition(sample.timestamp, common);
+            open_stack = stack;
+        }
+
+        functions.clear();
+        transition(last_timestamp + typical_interval, 0);
+    }
+
+    out.append("]}\n");
+}
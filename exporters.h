@@ -0,0 +1,69 @@
+//
+//  exporters.h
+//  drspin
+//
+
+#include "process.h"
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#ifndef EXPORTERS_H
+#define EXPORTERS_H
+
+// Collects output in a large buffer and writes it out in big chunks, for exporters that produce many small pieces.
+struct OutputBuffer : private DeleteImplicit {
+    OutputBuffer(FILE *file);
+    ~OutputBuffer();
+
+    void append(const char *data, size_t size);
+    void append(const std::string &string);
+    void append(char character);
+    void append_decimal(uint64_t value);
+
+    void flush();
+private:
+    static constexpr size_t capacity = 256 * 1024;
+
+    FILE *_file;
+    std::string _buffer;
+};
+
+enum class ExportFormat {
+    // The indented tree printed by Process::print_tree().
+    text,
+
+    // The top-functions table and bottom-up tree printed by Process::print_functions().
+    bottom_up,
+
+    // Just the top-functions table.
+    top,
+
+    // One line per distinct stack, with semicolon-separated function names and a count, as read by flamegraph.pl.
+    collapsed,
+
+    // An (uncompressed) pprof profile.proto.
+    pprof,
+
+    // speedscope's JSON file format, with a sampled profile per thread.
+    speedscope,
+
+    // A Chrome trace event JSON timeline (for chrome://tracing or Perfetto), with each thread's consecutive samples of a stack merged into spans.
+    trace,
+};
+
+// Parses a --format argument.  Returns false if it isn't recognized.
+bool parse_export_format(const char *name, ExportFormat &format);
+
+// Writes the samples in `process` that `options` selects to `file` in the given format.
+void export_profile(ExportFormat format, const Process &process, Symbolicator &symbolicator, const ReportOptions &options, FILE *file);
+
+// These write the selected samples in `process` to `file` in one pass over its distinct stacks, symbolicating every address (in one batch) first.  Frames are grouped by function, ignoring offsets.
+void export_collapsed(const Process &process, Symbolicator &symbolicator, SampleFilter filter, FILE *file);
+void export_pprof(const Process &process, Symbolicator &symbolicator, SampleFilter filter, FILE *file);
+void export_speedscope(const Process &process, Symbolicator &symbolicator, SampleFilter filter, FILE *file);
+void export_trace(const Process &process, Symbolicator &symbolicator, SampleFilter filter, FILE *file);
+
+#endif /* EXPORTERS_H */
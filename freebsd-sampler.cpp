@@ -0,0 +1,171 @@
+//
+//  freebsd-sampler.cpp
+//  drspin
+//
+
+#include "freebsd-sampler.h"
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <libutil.h>
+#include <unistd.h>
+#include <machine/reg.h>
+#include <sys/ptrace.h>
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+FreeBSDSampler::FreeBSDSampler(const pid_t pid)
+: _pid(pid) { }
+
+std::string FreeBSDSampler::process_name() {
+    struct kinfo_proc *const info = kinfo_getproc(_pid);
+    assert(info != NULL);
+
+    const std::string name = info->ki_comm;
+    free(info);
+
+    return name;
+}
+
+void FreeBSDSampler::attach() {
+    read_thread_states();
+
+    const int rv = ptrace(PT_ATTACH, _pid, 0, 0);
+    _syscalls.add("ptrace(PT_ATTACH)");
+    assert(!rv);
+
+    wait_for_stop();
+}
+
+void FreeBSDSampler::read_thread_states() {
+    int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID | KERN_PROC_INC_THREAD, _pid };
+    _thread_states.clear();
+
+    // Threads may be created between sizing the buffer and filling it, so leave some room, and try again if that wasn't enough.
+    for (;;) {
+        size_t length = 0;
+        int rv = sysctl(mib, 4, NULL, &length, NULL, 0);
+        _syscalls.add("sysctl(KERN_PROC_INC_THREAD)");
+
+        // The process might have exited.
+        if (rv) return;
+
+        _thread_infos.resize(length / sizeof (struct kinfo_proc) + 4);
+        length = _thread_infos.size() * sizeof (struct kinfo_proc);
+        rv = sysctl(mib, 4, _thread_infos.data(), &length, NULL, 0);
+        const int error = errno; // before counting the call, which may allocate
+        _syscalls.add("sysctl(KERN_PROC_INC_THREAD)");
+
+        if (rv && error == ENOMEM) continue;
+        if (rv) return;
+
+        for (size_t i = 0; i < length / sizeof (struct kinfo_proc); i++) {
+            const struct kinfo_proc &info = _thread_infos[i];
+
+            // SRUN covers both running and runnable threads; SSLEEP, SLOCK, SWAIT, and SSTOP are all off the CPU.
+            _thread_states[info.ki_tid] = {
+                .on_cpu = (info.ki_stat == SRUN),
+                .cpu_time = (uint64_t)info.ki_runtime * 1000,
+            };
+        }
+
+        return;
+    }
+}
+
+void FreeBSDSampler::request_stop() {
+    kill(_pid, SIGSTOP);
+    _syscalls.add("kill");
+}
+
+void FreeBSDSampler::wait_for_stop() {
+    int status;
+    const pid_t waited_pid = wait(&status);
+    _syscalls.add("wait");
+    assert(_pid == waited_pid);
+}
+
+void FreeBSDSampler::resume() {
+    const int rv = ptrace(PT_CONTINUE, _pid, (caddr_t)1, 0);
+    _syscalls.add("ptrace(PT_CONTINUE)");
+    assert(!rv);
+}
+
+void FreeBSDSampler::detach() {
+    const int rv = ptrace(PT_DETACH, _pid, (caddr_t)1, 0);
+    _syscalls.add("ptrace(PT_DETACH)");
+    assert(!rv);
+}
+
+std::vector<lwpid_t> FreeBSDSampler::threads() {
+    // The target is stopped, so the number of LWPs can't change between these two calls.
+    const int num_lwps = ptrace(PT_GETNUMLWPS, _pid, NULL, 0);
+    _syscalls.add("ptrace(PT_GETNUMLWPS)");
+    assert(num_lwps > 0);
+
+    std::vector<lwpid_t> lwpids(num_lwps);
+    const int num_listed = ptrace(PT_GETLWPLIST, _pid, (caddr_t)lwpids.data(), num_lwps);
+    _syscalls.add("ptrace(PT_GETLWPLIST)");
+    assert(num_listed > 0);
+
+    lwpids.resize(num_listed);
+    return lwpids;
+}
+
+Registers FreeBSDSampler::registers(const lwpid_t lwpid) {
+    struct reg regs;
+    const int rv = ptrace(PT_GETREGS, lwpid, (caddr_t)&regs, 0);
+    _syscalls.add("ptrace(PT_GETREGS)");
+    assert(!rv);
+
+#if defined(__x86_64__) && __x86_64__
+    return { .pc = (uintptr_t)regs.r_rip, .fp = (uintptr_t)regs.r_rbp, .sp = (uintptr_t)regs.r_rsp, .lr = 0 };
+#elif defined(__aarch64__) && __aarch64__
+    // elr is the "exception link register" -- i.e., PC saved from when we interrupted the process.  x29 is the frame pointer by convention.
+    return { .pc = (uintptr_t)regs.elr, .fp = (uintptr_t)regs.x[29], .sp = (uintptr_t)regs.sp, .lr = (uintptr_t)regs.lr };
+#else
+#error don't know how to get pc/fp/sp
+#endif
+}
+
+size_t FreeBSDSampler::read_once(const uintptr_t address, void *const buffer, const size_t size) {
+    struct ptrace_io_desc io_desc = {
+        .piod_op = PIOD_READ_D,
+        .piod_offs = (void *)address,
+        .piod_addr = buffer,
+        .piod_len = size,
+    };
+
+    const int rv = ptrace(PT_IO, _pid, (caddr_t)&io_desc, 0);
+    const bool fault = (rv && errno == EFAULT);
+    _syscalls.add("ptrace(PT_IO)");
+    assert(!rv || fault);
+
+    // On success, piod_len holds the number of bytes actually transferred.  (On failure, the kernel doesn't copy it back out.)
+    return rv ? 0 : io_desc.piod_len;
+}
+
+size_t FreeBSDSampler::read(const uintptr_t address, void *const buffer, const size_t size) {
+    const size_t count = read_once(address, buffer, size);
+    if (count != 0 || size == 0) return count;
+
+    // A faulting PT_IO doesn't tell us how much it could have read, so for large reads (e.g., of a stack window that runs off the end of the stack), fall back to reading a page at a time until we fault.
+    const size_t page_size = getpagesize();
+    size_t total = 0;
+
+    while (total < size) {
+        const uintptr_t chunk_address = address + total;
+        const size_t chunk_size = std::min(size - total, page_size - chunk_address % page_size);
+
+        if (read_once(chunk_address, (char *)buffer + total, chunk_size) != chunk_size) break;
+        total += chunk_size;
+    }
+
+    return total;
+}
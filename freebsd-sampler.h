@@ -0,0 +1,36 @@
+//
+//  freebsd-sampler.h
+//  drspin
+//
+
+#include "sampler.h"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/user.h>
+
+#ifndef FREEBSD_SAMPLER_H
+#define FREEBSD_SAMPLER_H
+
+struct FreeBSDSampler : public Sampler {
+    FreeBSDSampler(pid_t pid);
+    std::string process_name();
+    void attach();
+    void read_thread_states();
+    void request_stop();
+    void wait_for_stop();
+    void resume();
+    void detach();
+    std::vector<lwpid_t> threads();
+    Registers registers(lwpid_t lwpid);
+    size_t read(uintptr_t address, void *buffer, size_t size);
+private:
+    size_t read_once(uintptr_t address, void *buffer, size_t size);
+    pid_t _pid;
+
+    // The buffer for the per-thread kinfo_procs, kept from one read to the next.
+    std::vector<struct kinfo_proc> _thread_infos;
+};
+
+#endif /* FREEBSD_SAMPLER_H */
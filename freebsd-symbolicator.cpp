@@ -7,7 +7,7 @@
 
 #include "freebsd-symbolicator.h"
 #include <assert.h>
-#include <filesystem>
+#include <algorithm>
 #include <optional>
 #include <string>
 #include <utility>
@@ -19,47 +19,19 @@
 #include <sys/linker.h>
 #include <sys/link_elf.h>
 #include <sys/mman.h>
-#include <sys/ptrace.h>
 #include <sys/stat.h>
 #include <sys/sysctl.h>
 
-template<typename T>
-T remote_read(const pid_t pid, const uintptr_t addr) {
-    T data;
-    struct ptrace_io_desc io_desc = {
-        .piod_op = PIOD_READ_D,
-        .piod_offs = (void *)addr,
-        .piod_addr = &data,
-        .piod_len = sizeof (T),
-    };
-
-    const int rv = ptrace(PT_IO, pid, (caddr_t)&io_desc, 0);
-    assert(!rv);
-
-    return data;
-}
-
-std::string remote_read_string(const pid_t pid, const uintptr_t addr) {
-    std::string result = "";
-    uintptr_t cur_addr = addr;
-
-    for (;;) {
-        const char c = remote_read<char>(pid, cur_addr);
-        if (c == '\0') break;
-        result += c;
-        cur_addr++;
-    }
-
-    return result;
-}
-
 template<typename T>
 struct RemoteArray {
-    RemoteArray(const pid_t pid, const uintptr_t base_address, const size_t count)
-    : _pid(pid), _base_address(base_address), _count(count) {}
+    RemoteArray(RemoteMemory &memory, const uintptr_t base_address, const size_t count)
+    : _memory(memory), _base_address(base_address), _count(count) {
+        // Bring the whole array into the cache in one transfer, rather than a page at a time as we iterate.
+        _memory.prefetch(base_address, count * sizeof (T));
+    }
 
     T get(const size_t index) const {
-        return remote_read<T>(_pid, _base_address + index * sizeof (T));
+        return _memory.read<T>(_base_address + index * sizeof (T));
     }
 
     struct Iterator {
@@ -92,13 +64,13 @@ struct RemoteArray {
     }
 
 private:
-    const pid_t _pid;
+    RemoteMemory &_memory;
     const uintptr_t _base_address;
     const size_t _count;
 };
 
 // Scan the process's `auxv` array for an AT_PHDR entry, and return its value, which is the address of the Elf_Phdr in the process's address space.
-std::pair<RemoteArray<Elf_Phdr>, uintptr_t> get_phdr_array(const pid_t pid) {
+std::pair<RemoteArray<Elf_Phdr>, uintptr_t> get_phdr_array(const pid_t pid, RemoteMemory &memory) {
     const int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_AUXV, pid };
     Elf_Auxinfo auxv[AT_COUNT];
     size_t auxv_size = sizeof (auxv);
@@ -118,11 +90,11 @@ std::pair<RemoteArray<Elf_Phdr>, uintptr_t> get_phdr_array(const pid_t pid) {
         }
     }
 
-    return { RemoteArray<Elf_Phdr>(pid, base_address, count), base_address };
+    return { RemoteArray<Elf_Phdr>(memory, base_address, count), base_address };
 }
 
-RemoteArray<Elf_Dyn> get_dyn_array(const pid_t pid) {
-    const auto [phdr_array, phdr_base_address] = get_phdr_array(pid);
+RemoteArray<Elf_Dyn> get_dyn_array(const pid_t pid, RemoteMemory &memory) {
+    const auto [phdr_array, phdr_base_address] = get_phdr_array(pid, memory);
 
     std::optional<uintptr_t> dyn_base_address;
     std::optional<size_t> dyn_count;
@@ -141,11 +113,11 @@ RemoteArray<Elf_Dyn> get_dyn_array(const pid_t pid) {
     assert(dyn_count.has_value());
     assert(slide.has_value());
 
-    return RemoteArray<Elf_Dyn>(pid, dyn_base_address.value() + slide.value(), dyn_count.value());
+    return RemoteArray<Elf_Dyn>(memory, dyn_base_address.value() + slide.value(), dyn_count.value());
 }
 
-uintptr_t read_debug_ptr(const pid_t pid) {
-    const RemoteArray<Elf_Dyn> dyn_array = get_dyn_array(pid);
+uintptr_t read_debug_ptr(const pid_t pid, RemoteMemory &memory) {
+    const RemoteArray<Elf_Dyn> dyn_array = get_dyn_array(pid, memory);
 
     for (const Elf_Dyn dyn : dyn_array) {
         if (dyn.d_tag == DT_DEBUG) {
@@ -157,15 +129,16 @@ uintptr_t read_debug_ptr(const pid_t pid) {
     abort();
 }
 
-std::vector<Library> read_libraries(const pid_t pid) {
-    const uintptr_t debug_ptr = read_debug_ptr(pid);
-    const struct r_debug debug = remote_read<struct r_debug>(pid, debug_ptr);
+// Returns the path and load address of each loaded object.
+std::vector<std::pair<std::string, uintptr_t>> read_libraries(const pid_t pid, RemoteMemory &memory) {
+    const uintptr_t debug_ptr = read_debug_ptr(pid, memory);
+    const struct r_debug debug = memory.read<struct r_debug>(debug_ptr);
     uintptr_t link_map_ptr = (uintptr_t)debug.r_map;
-    std::vector<Library> libraries;
+    std::vector<std::pair<std::string, uintptr_t>> libraries;
 
     while (link_map_ptr != 0) {
-        const Link_map map = remote_read<Link_map>(pid, link_map_ptr);
-        const std::string path = remote_read_string(pid, (uintptr_t)map.l_name);
+        const Link_map map = memory.read<Link_map>(link_map_ptr);
+        const std::string path = memory.read_string((uintptr_t)map.l_name);
 
         libraries.emplace_back(path, (uintptr_t)map.l_base);
         link_map_ptr = (uintptr_t)map.l_next;
@@ -174,135 +147,17 @@ std::vector<Library> read_libraries(const pid_t pid) {
     return libraries;
 }
 
-Symbol::Symbol(std::string name, uintptr_t address, size_t size)
-: _name(name), _address(address), _size(size) { }
-
-std::string Symbol::name() const {
-    return _name;
-}
-
-uintptr_t Symbol::address() const {
-    return _address;
-}
-
-size_t Symbol::size() const {
-    return _size;
-}
-
-Library::Library(const std::string path, const uintptr_t load_address)
-: _path(path), _load_address(load_address) {
-    if (path == "[vdso]") return;
-
-    const MappedFile file(path);
-    const Elf_Ehdr *const header = file.read<Elf_Ehdr>(0);
-
-    // Get the unslid base address.
-    bool got_base_address = false;
-    for (const Elf_Phdr &phdr : file.read_array<Elf_Phdr>(header->e_phoff, header->e_phnum)) {
-        if (phdr.p_type == PT_LOAD) {
-            _base_address = (uintptr_t)phdr.p_vaddr;
-            got_base_address = true;
-            break;
-        }
-    }
-    assert(got_base_address);
-
-    // Find the symbol tables and their associated string tables.
-    StaticUnownedArray<Elf_Sym> symtab, dynsymtab;
-    const char *strtab = NULL;
-    const char *dynstrtab = NULL;
-
-    // Using the section names string table, walk the sections array.
-    const StaticUnownedArray<Elf_Shdr> sections = file.read_array<Elf_Shdr>(header->e_shoff, header->e_shnum);
-    const char *const shstrtab = file.read<char>(sections[header->e_shstrndx].sh_offset);
-
-    for (const Elf_Shdr &section : sections) {
-        if (section.sh_type == SHT_SYMTAB) {
-            symtab = file.read_array<Elf_Sym>(section.sh_offset, section.sh_size / sizeof (Elf_Sym));
-        } else if (section.sh_type == SHT_DYNSYM) {
-            dynsymtab = file.read_array<Elf_Sym>(section.sh_offset, section.sh_size / sizeof (Elf_Sym));
-        } else if (section.sh_type == SHT_STRTAB) {
-            const char *const name = shstrtab + section.sh_name;
-
-            if (!strcmp(name, ".strtab")) {
-                strtab = file.read<char>(section.sh_offset);
-            } else if (!strcmp(name, ".dynstr")) {
-                dynstrtab = file.read<char>(section.sh_offset);
-            }
-        }
-    }
-
-    assert(symtab.count() == 0 || strtab != NULL);
-    assert(dynsymtab.count() == 0 || dynstrtab != NULL);
-
-    // Add symbols from both symbol tables.
-    for (const Elf_Sym &symbol : symtab) {
-        if (symbol.st_size > 0) {
-            const std::string name = strtab + symbol.st_name;
-            _symbols.emplace_back(name, symbol.st_value, symbol.st_size);
-        }
-    }
-
-    for (const Elf_Sym &symbol : dynsymtab) {
-        if (symbol.st_size > 0) {
-            const std::string name = dynstrtab + symbol.st_name;
-            _symbols.emplace_back(name, symbol.st_value, symbol.st_size);
-        }
-    }
-
-    // TODO: add "artificial" symbols by parsing the PLT, like lldb does
-
-    std::sort(_symbols.begin(), _symbols.end(), [](const Symbol &a, const Symbol &b) {
-        return a.address() < b.address();
-    });
-}
+FreeBSDUserSymbolicator::FreeBSDUserSymbolicator(const pid_t pid, RemoteMemory &memory) {
+    _pid = pid;
+    std::vector<std::pair<std::string, uintptr_t>> libraries = read_libraries(pid, memory);
 
-std::string Library::symbolicate(const uintptr_t address) const {
-    // upper_bound() returns the first symbol *greater than* the supplied address (or end() if none).
-    auto iter = std::upper_bound(_symbols.begin(), _symbols.end(), address,
-                                 [](const uintptr_t address, const Symbol &symbol) {
-        return address < symbol.address();
+    std::sort(libraries.begin(), libraries.end(), [](const auto &a, const auto &b) {
+        return a.second < b.second;
     });
 
-    std::string base_string = "???";
-
-    if (iter != _symbols.begin()) {
-        iter--;
-
-        const Symbol &symbol = *iter;
-        const uintptr_t offset = address - symbol.address();
-
-        if (offset < symbol.size()) {
-            base_string = symbol.name() + " + " + std::to_string(offset);
-        }
+    for (const auto &[path, load_address] : libraries) {
+        add_library(path, load_address);
     }
-
-    return base_string + " (in " + name() + ")";
-}
-
-std::string Library::path() const {
-    return _path;
-}
-
-std::string Library::name() const {
-    return std::filesystem::path(_path).filename().string();
-}
-
-uintptr_t Library::load_address() const {
-    return _load_address;
-}
-
-uintptr_t Library::base_address() const {
-    return _base_address;
-}
-
-FreeBSDUserSymbolicator::FreeBSDUserSymbolicator(const pid_t pid) {
-    _pid = pid;
-    _libraries = read_libraries(pid);
-
-    std::sort(_libraries.begin(), _libraries.end(), [](const Library &a, const Library b) {
-        return a.load_address() < b.load_address();
-    });
 }
 
 FreeBSDKernelSymbolicator::FreeBSDKernelSymbolicator() {
@@ -311,31 +166,6 @@ FreeBSDKernelSymbolicator::FreeBSDKernelSymbolicator() {
         const int rv = kldstat(fileid, &stat);
         assert(!rv);
 
-        _libraries.emplace_back(std::string("/boot/kernel/") + stat.name, (uintptr_t)stat.address);
-    }
-}
-
-std::string FreeBSDSymbolicator::symbolicate(const uintptr_t address) {
-    if (address == 0) return std::string("...");
-
-    // upper_bound() returns the first library *greater than* the supplied address (or end() if none).
-    auto iter = std::upper_bound(_libraries.begin(), _libraries.end(), address,
-                                 [](const uintptr_t address, const Library &library) {
-        return address < library.load_address();
-    });
-
-    if (iter != _libraries.begin()) {
-        iter--;
-
-        const Library &library = *iter;
-        return library.symbolicate(library.base_address() + address - library.load_address());
-    } else {
-        return "???";
-    }
-}
-
-void FreeBSDSymbolicator::print_libraries() const {
-    for (const Library &library : _libraries) {
-        printf("%#18lx  %s\n", library.load_address(), library.path().c_str());
+        add_library(std::string("/boot/kernel/") + stat.name, (uintptr_t)stat.address);
     }
 }
@@ -0,0 +1,49 @@
+//
+//  function-table.cpp
+//  drspin
+//
+
+#include "function-table.h"
+#include <assert.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+FunctionTable::FunctionTable(const StackTrie &stacks, Symbolicator &symbolicator)
+: addresses(stacks.addresses()), _symbols(symbolicator, addresses, stacks.return_addresses()) {
+    std::unordered_map<std::string, size_t> indexes;
+    _address_functions.reserve(addresses.size());
+
+    for (const uintptr_t address : addresses) {
+        const Symbol &symbol = _symbols.symbol(address);
+        const std::string &name = symbol.function.empty() ? symbol.description : symbol.function;
+        const auto [entry, inserted] = indexes.try_emplace(name + '\0' + symbol.library, functions.size());
+
+        if (inserted) {
+            // An unknown function's name, its address's description, already says where it is.
+            const std::string label = (symbol.function.empty() || symbol.library.empty()) ? name : name + " (in " + symbol.library + ")";
+            functions.push_back({ .name = name, .library = symbol.library, .label = label, .file = symbol.file, .line = symbol.line });
+        }
+
+        // A function's line is the earliest one sampled, which is as close as we can get to where it starts.  Lines only compare within a file (inlined code brings lines from headers and other files), so the file and line change together.
+        Function &function = functions[entry->second];
+
+        if (symbol.line != 0 && (function.line == 0 || (symbol.file == function.file && symbol.line < function.line))) {
+            function.file = symbol.file;
+            function.line = symbol.line;
+        }
+
+        _address_functions.emplace(address, entry->second);
+    }
+}
+
+size_t FunctionTable::function(const uintptr_t address) const {
+    const auto entry = _address_functions.find(address);
+    assert(entry != _address_functions.end());
+
+    return entry->second;
+}
+
+const Symbol &FunctionTable::symbol(const uintptr_t address) const {
+    return _symbols.symbol(address);
+}
@@ -0,0 +1,44 @@
+//
+//  function-table.h
+//  drspin
+//
+
+#include "stack-trie.h"
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef FUNCTION_TABLE_H
+#define FUNCTION_TABLE_H
+
+// Groups addresses by the function they're in, for reports and exporters that ignore offsets.  Functions are numbered (from 0) in order of first appearance, by name and library; an address in an unknown function gets a function of its own named by its description (e.g., "??? (in libc.so.7)").
+struct FunctionTable : private DeleteImplicit {
+    // Symbolicates the addresses in `stacks` (in one batch) and groups them.
+    FunctionTable(const StackTrie &stacks, Symbolicator &symbolicator);
+
+    size_t function(uintptr_t address) const;
+    const Symbol &symbol(uintptr_t address) const;
+
+    struct Function {
+        std::string name;
+        std::string library;
+
+        // How text reports show the function, e.g., "main (in drspin)".
+        std::string label;
+
+        // The function's source file and (lowest sampled) line, if known.
+        std::string file;
+        unsigned int line;
+    };
+
+    const std::vector<uintptr_t> addresses;
+    std::vector<Function> functions;
+private:
+    const SymbolTable _symbols;
+    std::unordered_map<uintptr_t, size_t> _address_functions;
+};
+
+#endif /* FUNCTION_TABLE_H */
@@ -0,0 +1,74 @@
+//
+//  histogram.h
+//  drspin
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// A log-linear histogram of nonnegative integers (e.g., durations in nanoseconds).  Each power of two is split into 16 linear buckets, so percentiles are accurate to within about 6%, in constant space.
+struct Histogram {
+    void add(const uint64_t value) {
+        _counts[bucket(value)]++;
+        _count++;
+        _sum += value;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+    }
+
+    uint64_t count() const { return _count; }
+    uint64_t sum() const { return _sum; }
+    uint64_t min() const { return _count > 0 ? _min : 0; }
+    uint64_t max() const { return _max; }
+
+    // Returns (an upper bound on) the value at percentile `p`, which is between 0 and 100.
+    uint64_t percentile(const double p) const {
+        const uint64_t rank = std::max((uint64_t)1, (uint64_t)(p / 100 * _count + 0.5));
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < _counts.size(); i++) {
+            seen += _counts[i];
+
+            if (seen >= rank) {
+                return std::min(bucket_limit(i), _max);
+            }
+        }
+
+        return _max;
+    }
+private:
+    static constexpr unsigned int sub_bucket_bits = 4;
+    static constexpr uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+
+    static size_t bucket(const uint64_t value) {
+        if (value < sub_bucket_count) return value;
+
+        const unsigned int exponent = 63 - __builtin_clzll(value);
+        const uint64_t sub_bucket = (value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+
+        return (exponent - sub_bucket_bits + 1) * sub_bucket_count + sub_bucket;
+    }
+
+    // The largest value in bucket `index`.
+    static uint64_t bucket_limit(const size_t index) {
+        if (index < sub_bucket_count) return index;
+
+        const unsigned int exponent = index / sub_bucket_count + sub_bucket_bits - 1;
+        const uint64_t lower = (sub_bucket_count + index % sub_bucket_count) << (exponent - sub_bucket_bits);
+
+        return lower + ((uint64_t)1 << (exponent - sub_bucket_bits)) - 1;
+    }
+
+    std::array<uint64_t, (64 - sub_bucket_bits + 1) * sub_bucket_count> _counts = {};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = UINT64_MAX;
+    uint64_t _max = 0;
+};
+
+#endif /* HISTOGRAM_H */
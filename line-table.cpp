@@ -0,0 +1,852 @@
+//
+//  line-table.cpp
+//  drspin
+//
+
+#include "line-table.h"
+#include "dwarf-reader.h"
+#include "elf-symbolicator.h"
+#include "elf-types.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef SHF_COMPRESSED
+#define SHF_COMPRESSED 0x800
+#endif
+
+// DWARF constants, from the DWARF 5 standard.
+enum {
+    DW_AT_stmt_list = 0x10,
+    DW_AT_low_pc = 0x11,
+    DW_AT_high_pc = 0x12,
+    DW_AT_ranges = 0x55,
+    DW_AT_addr_base = 0x73,
+    DW_AT_rnglists_base = 0x74,
+
+    DW_FORM_addr = 0x01,
+    DW_FORM_block2 = 0x03,
+    DW_FORM_block4 = 0x04,
+    DW_FORM_data2 = 0x05,
+    DW_FORM_data4 = 0x06,
+    DW_FORM_data8 = 0x07,
+    DW_FORM_string = 0x08,
+    DW_FORM_block = 0x09,
+    DW_FORM_block1 = 0x0a,
+    DW_FORM_data1 = 0x0b,
+    DW_FORM_flag = 0x0c,
+    DW_FORM_sdata = 0x0d,
+    DW_FORM_strp = 0x0e,
+    DW_FORM_udata = 0x0f,
+    DW_FORM_ref_addr = 0x10,
+    DW_FORM_ref1 = 0x11,
+    DW_FORM_ref2 = 0x12,
+    DW_FORM_ref4 = 0x13,
+    DW_FORM_ref8 = 0x14,
+    DW_FORM_ref_udata = 0x15,
+    DW_FORM_indirect = 0x16,
+    DW_FORM_sec_offset = 0x17,
+    DW_FORM_exprloc = 0x18,
+    DW_FORM_flag_present = 0x19,
+    DW_FORM_strx = 0x1a,
+    DW_FORM_addrx = 0x1b,
+    DW_FORM_ref_sup4 = 0x1c,
+    DW_FORM_strp_sup = 0x1d,
+    DW_FORM_data16 = 0x1e,
+    DW_FORM_line_strp = 0x1f,
+    DW_FORM_ref_sig8 = 0x20,
+    DW_FORM_implicit_const = 0x21,
+    DW_FORM_loclistx = 0x22,
+    DW_FORM_rnglistx = 0x23,
+    DW_FORM_ref_sup8 = 0x24,
+    DW_FORM_strx1 = 0x25,
+    DW_FORM_strx2 = 0x26,
+    DW_FORM_strx3 = 0x27,
+    DW_FORM_strx4 = 0x28,
+    DW_FORM_addrx1 = 0x29,
+    DW_FORM_addrx2 = 0x2a,
+    DW_FORM_addrx3 = 0x2b,
+    DW_FORM_addrx4 = 0x2c,
+    DW_FORM_GNU_addr_index = 0x1f01,
+    DW_FORM_GNU_str_index = 0x1f02,
+    DW_FORM_GNU_ref_alt = 0x1f20,
+    DW_FORM_GNU_strp_alt = 0x1f21,
+
+    DW_UT_compile = 0x01,
+    DW_UT_partial = 0x03,
+
+    DW_LNCT_path = 0x1,
+    DW_LNCT_directory_index = 0x2,
+
+    DW_LNS_copy = 1,
+    DW_LNS_advance_pc = 2,
+    DW_LNS_advance_line = 3,
+    DW_LNS_set_file = 4,
+    DW_LNS_const_add_pc = 8,
+    DW_LNS_fixed_advance_pc = 9,
+
+    DW_LNE_end_sequence = 1,
+    DW_LNE_set_address = 2,
+
+    DW_RLE_end_of_list = 0,
+    DW_RLE_base_addressx = 1,
+    DW_RLE_startx_endx = 2,
+    DW_RLE_startx_length = 3,
+    DW_RLE_offset_pair = 4,
+    DW_RLE_base_address = 5,
+    DW_RLE_start_end = 6,
+    DW_RLE_start_length = 7,
+};
+
+// The properties of a unit that decide how its attribute values are encoded.
+struct Encoding {
+    unsigned int version;
+    bool dwarf64;
+    uint8_t address_size;
+};
+
+// Skips an attribute value.  Returns false if the form is unknown, in which case nothing after it can be found.
+static bool skip_form(DwarfReader &reader, const uint64_t form, const Encoding &encoding) {
+    switch (form) {
+        case DW_FORM_flag_present:
+        case DW_FORM_implicit_const:
+            return true;
+        case DW_FORM_data1:
+        case DW_FORM_ref1:
+        case DW_FORM_flag:
+        case DW_FORM_strx1:
+        case DW_FORM_addrx1:
+            reader.skip(1);
+            return true;
+        case DW_FORM_data2:
+        case DW_FORM_ref2:
+        case DW_FORM_strx2:
+        case DW_FORM_addrx2:
+            reader.skip(2);
+            return true;
+        case DW_FORM_strx3:
+        case DW_FORM_addrx3:
+            reader.skip(3);
+            return true;
+        case DW_FORM_data4:
+        case DW_FORM_ref4:
+        case DW_FORM_ref_sup4:
+        case DW_FORM_strx4:
+        case DW_FORM_addrx4:
+            reader.skip(4);
+            return true;
+        case DW_FORM_data8:
+        case DW_FORM_ref8:
+        case DW_FORM_ref_sig8:
+        case DW_FORM_ref_sup8:
+            reader.skip(8);
+            return true;
+        case DW_FORM_data16:
+            reader.skip(16);
+            return true;
+        case DW_FORM_addr:
+            reader.skip(encoding.address_size);
+            return true;
+        case DW_FORM_ref_addr:
+            // In DWARF 2, this was address-sized.
+            reader.skip(encoding.version == 2 ? encoding.address_size : (encoding.dwarf64 ? 8 : 4));
+            return true;
+        case DW_FORM_strp:
+        case DW_FORM_line_strp:
+        case DW_FORM_sec_offset:
+        case DW_FORM_strp_sup:
+        case DW_FORM_GNU_ref_alt:
+        case DW_FORM_GNU_strp_alt:
+            reader.offset(encoding.dwarf64);
+            return true;
+        case DW_FORM_sdata:
+            reader.sleb128();
+            return true;
+        case DW_FORM_udata:
+        case DW_FORM_ref_udata:
+        case DW_FORM_strx:
+        case DW_FORM_addrx:
+        case DW_FORM_loclistx:
+        case DW_FORM_rnglistx:
+        case DW_FORM_GNU_addr_index:
+        case DW_FORM_GNU_str_index:
+            reader.uleb128();
+            return true;
+        case DW_FORM_string:
+            reader.string();
+            return true;
+        case DW_FORM_block1:
+            reader.skip(reader.fixed<uint8_t>());
+            return true;
+        case DW_FORM_block2:
+            reader.skip(reader.fixed<uint16_t>());
+            return true;
+        case DW_FORM_block4:
+            reader.skip(reader.fixed<uint32_t>());
+            return true;
+        case DW_FORM_block:
+        case DW_FORM_exprloc:
+            reader.skip(reader.uleb128());
+            return true;
+        case DW_FORM_indirect:
+            return skip_form(reader, reader.uleb128(), encoding);
+        default:
+            return false;
+    }
+}
+
+// Reads an unsigned attribute value.  Returns false if the form isn't one for unsigned constants.
+static bool read_unsigned_form(DwarfReader &reader, const uint64_t form, const Encoding &encoding, uint64_t &value) {
+    switch (form) {
+        case DW_FORM_data1: value = reader.fixed<uint8_t>(); return true;
+        case DW_FORM_data2: value = reader.fixed<uint16_t>(); return true;
+        case DW_FORM_data4: value = reader.fixed<uint32_t>(); return true;
+        case DW_FORM_data8: value = reader.fixed<uint64_t>(); return true;
+        case DW_FORM_udata: value = reader.uleb128(); return true;
+        case DW_FORM_sec_offset: value = reader.offset(encoding.dwarf64); return true;
+        default: return false;
+    }
+}
+
+static std::string join_path(const std::string &directory, const char *const name) {
+    if (directory.empty() || name[0] == '/') return name;
+    return directory + "/" + name;
+}
+
+LineTable::LineTable(const std::string &path, const std::string &build_id)
+: _info(), _abbrev(), _line(), _str(), _line_str(), _aranges(), _addr(), _ranges_section(), _rnglists() {
+    // Distributions strip debug info into separate files, named by build ID (on Linux) or by path (on FreeBSD).
+    std::vector<std::string> candidates = { path };
+
+    if (build_id.size() > 2) {
+        candidates.push_back("/usr/lib/debug/.build-id/" + build_id.substr(0, 2) + "/" + build_id.substr(2) + ".debug");
+    }
+
+    candidates.push_back("/usr/lib/debug" + path + ".debug");
+
+    for (const std::string &candidate : candidates) {
+        if (is_elf(candidate.c_str()) && load(candidate)) break;
+    }
+
+    if (_file) {
+        read_aranges();
+    }
+}
+
+bool LineTable::load(const std::string &path) {
+    std::unique_ptr<const MappedFile> file = std::make_unique<const MappedFile>(path);
+    const size_t size = file->size();
+
+    if (size < sizeof (Elf_Ehdr)) return false;
+    const Elf_Ehdr *const header = file->read<Elf_Ehdr>(0);
+
+    if (header->e_shoff > size || header->e_shnum > (size - header->e_shoff) / sizeof (Elf_Shdr) || header->e_shstrndx >= header->e_shnum) return false;
+    const StaticUnownedArray<Elf_Shdr> sections = file->read_array<Elf_Shdr>(header->e_shoff, header->e_shnum);
+
+    const Elf_Shdr &shstrtab = sections[header->e_shstrndx];
+    if (shstrtab.sh_offset > size || shstrtab.sh_size > size - shstrtab.sh_offset) return false;
+
+    Section info = {}, abbrev = {}, line = {}, str = {}, line_str = {}, aranges = {}, addr = {}, ranges = {}, rnglists = {};
+    const std::pair<const char *, Section *> wanted[] = {
+        { ".debug_info", &info },
+        { ".debug_abbrev", &abbrev },
+        { ".debug_line", &line },
+        { ".debug_str", &str },
+        { ".debug_line_str", &line_str },
+        { ".debug_aranges", &aranges },
+        { ".debug_addr", &addr },
+        { ".debug_ranges", &ranges },
+        { ".debug_rnglists", &rnglists },
+    };
+
+    for (const Elf_Shdr &section : sections) {
+        // Compressed sections would have to be inflated in full, which defeats the point of decoding lazily.
+        if (section.sh_type == SHT_NOBITS || (section.sh_flags & SHF_COMPRESSED)) continue;
+        if (section.sh_name >= shstrtab.sh_size || section.sh_offset > size || section.sh_size > size - section.sh_offset) continue;
+
+        const char *const name = file->read<char>(shstrtab.sh_offset + section.sh_name);
+
+        for (const auto &[wanted_name, destination] : wanted) {
+            if (!strncmp(name, wanted_name, shstrtab.sh_size - section.sh_name)) {
+                *destination = { .data = file->read<uint8_t>(section.sh_offset), .size = section.sh_size };
+            }
+        }
+    }
+
+    if (info.data == nullptr || abbrev.data == nullptr || line.data == nullptr) return false;
+
+    _file = std::move(file);
+    _info = info;
+    _abbrev = abbrev;
+    _line = line;
+    _str = str;
+    _line_str = line_str;
+    _aranges = aranges;
+    _addr = addr;
+    _ranges_section = ranges;
+    _rnglists = rnglists;
+
+    return true;
+}
+
+void LineTable::read_aranges() {
+    std::unordered_map<uint64_t, size_t> unit_indexes;
+
+    const auto unit_index = [&](const uint64_t info_offset) {
+        const auto [entry, inserted] = unit_indexes.try_emplace(info_offset, _units.size());
+
+        if (inserted) {
+            Unit &unit = _units.emplace_back();
+            unit.info_offset = info_offset;
+            unit.decoded = std::make_unique<std::once_flag>();
+        }
+
+        return entry->second;
+    };
+
+    if (_aranges.data != nullptr) {
+        DwarfReader aranges(_aranges.data, _aranges.data + _aranges.size, 0);
+
+        while (aranges.position < aranges.end && !aranges.error) {
+            const uint8_t *const set_start = aranges.position;
+            bool dwarf64;
+            DwarfReader set = aranges.entry(&dwarf64);
+
+            set.fixed<uint16_t>(); // version
+            const uint64_t info_offset = set.offset(dwarf64);
+            const uint8_t address_size = set.fixed<uint8_t>();
+            set.fixed<uint8_t>(); // segment selector size
+
+            if (set.error || address_size != sizeof (uintptr_t)) continue;
+
+            // The tuples are aligned to their size, relative to the start of the set.
+            const size_t tuple_size = 2 * address_size;
+            const size_t header_size = set.position - set_start;
+            set.skip((tuple_size - header_size % tuple_size) % tuple_size);
+
+            const size_t unit = unit_index(info_offset);
+
+            while (!set.error) {
+                const uintptr_t start = set.fixed<uintptr_t>();
+                const uintptr_t length = set.fixed<uintptr_t>();
+                if (set.error || (start == 0 && length == 0)) break;
+
+                if (length > 0) {
+                    _ranges.push_back({ .start = start, .end = start + length, .unit = unit });
+                }
+            }
+        }
+    }
+
+    if (_ranges.empty()) {
+        // Without .debug_aranges (which clang doesn't emit by default), find what each unit covers from its first DIE.
+        _units.clear();
+        unit_indexes.clear();
+
+        DwarfReader info(_info.data, _info.data + _info.size, 0);
+
+        while (info.position < info.end && !info.error) {
+            const uint64_t info_offset = info.position - _info.data;
+            info.entry();
+            if (info.error) break;
+
+            const size_t index = unit_index(info_offset);
+            if (read_unit_ranges(index)) continue;
+
+            // A unit whose DIE doesn't say has to be decoded now: each of its sequences covers from its first row to its end.
+            Unit &unit = _units[index];
+            std::call_once(*unit.decoded, &LineTable::decode, this, std::ref(unit));
+
+            for (size_t j = 0; j < unit.rows.size();) {
+                size_t k = j;
+                while (k < unit.rows.size() && unit.rows[k].line != 0) k++;
+
+                if (k < unit.rows.size() && unit.rows[k].address > unit.rows[j].address) {
+                    _ranges.push_back({ .start = unit.rows[j].address, .end = unit.rows[k].address, .unit = index });
+                }
+
+                j = k + 1;
+            }
+        }
+    }
+
+    std::sort(_ranges.begin(), _ranges.end(), [](const Range &a, const Range &b) {
+        return a.start < b.start;
+    });
+}
+
+template<typename Visitor>
+bool LineTable::read_unit_die(const uint64_t info_offset, Visitor visit) {
+    if (info_offset >= _info.size) return false;
+
+    DwarfReader info(_info.data + info_offset, _info.data + _info.size, 0);
+    Encoding encoding;
+    DwarfReader cu = info.entry(&encoding.dwarf64);
+    encoding.version = cu.fixed<uint16_t>();
+
+    uint64_t abbrev_offset;
+
+    if (encoding.version >= 5) {
+        const uint8_t unit_type = cu.fixed<uint8_t>();
+        encoding.address_size = cu.fixed<uint8_t>();
+        abbrev_offset = cu.offset(encoding.dwarf64);
+
+        if (unit_type != DW_UT_compile && unit_type != DW_UT_partial) return false;
+    } else {
+        abbrev_offset = cu.offset(encoding.dwarf64);
+        encoding.address_size = cu.fixed<uint8_t>();
+    }
+
+    const uint64_t code = cu.uleb128();
+    if (cu.error || encoding.version < 2 || encoding.version > 5 || abbrev_offset >= _abbrev.size) return false;
+
+    DwarfReader abbrev(_abbrev.data + abbrev_offset, _abbrev.data + _abbrev.size, 0);
+
+    // Find the DIE's abbreviation.
+    for (;;) {
+        const uint64_t abbrev_code = abbrev.uleb128();
+        if (abbrev.error || abbrev_code == 0) return false;
+
+        abbrev.uleb128(); // tag
+        abbrev.fixed<uint8_t>(); // children
+        if (abbrev_code == code) break;
+
+        for (;;) {
+            const uint64_t attribute = abbrev.uleb128();
+            const uint64_t form = abbrev.uleb128();
+            if (form == DW_FORM_implicit_const) abbrev.sleb128();
+            if (abbrev.error || (attribute == 0 && form == 0)) break;
+        }
+    }
+
+    for (;;) {
+        const uint64_t attribute = abbrev.uleb128();
+        const uint64_t form = abbrev.uleb128();
+        if (form == DW_FORM_implicit_const) abbrev.sleb128();
+        if (abbrev.error || (attribute == 0 && form == 0)) break;
+
+        if (!visit(attribute, form, cu, encoding) && !skip_form(cu, form, encoding)) return false;
+        if (cu.error) return false;
+    }
+
+    return true;
+}
+
+bool LineTable::read_unit_ranges(const size_t unit_index) {
+    // The addresses the unit covers are given by its first DIE: either DW_AT_low_pc and DW_AT_high_pc (an address, or in DWARF 4 and later, possibly a length), or DW_AT_ranges, which refers to a range list (in .debug_ranges, or in DWARF 5, .debug_rnglists).  DWARF 5 addresses may be indexes into .debug_addr, as may range lists, relative to the unit's DW_AT_addr_base and DW_AT_rnglists_base, which can come in any order.
+    struct Value {
+        uint64_t form = 0;
+        uint64_t value = 0;
+    };
+
+    Value low_pc, high_pc, ranges;
+    uint64_t addr_base = 0, rnglists_base = 0;
+    Encoding encoding = {};
+
+    const bool read = read_unit_die(_units[unit_index].info_offset, [&](const uint64_t attribute, const uint64_t form, DwarfReader &die, const Encoding &unit_encoding) {
+        encoding = unit_encoding;
+        Value *destination;
+
+        switch (attribute) {
+            case DW_AT_low_pc: destination = &low_pc; break;
+            case DW_AT_high_pc: destination = &high_pc; break;
+            case DW_AT_ranges: destination = &ranges; break;
+            case DW_AT_addr_base: return read_unsigned_form(die, form, unit_encoding, addr_base);
+            case DW_AT_rnglists_base: return read_unsigned_form(die, form, unit_encoding, rnglists_base);
+            default: return false;
+        }
+
+        switch (form) {
+            case DW_FORM_addr: destination->value = (encoding.address_size == 4) ? die.fixed<uint32_t>() : die.fixed<uint64_t>(); break;
+            case DW_FORM_addrx1: destination->value = die.fixed<uint8_t>(); break;
+            case DW_FORM_addrx2: destination->value = die.fixed<uint16_t>(); break;
+            case DW_FORM_addrx3: destination->value = die.fixed<uint16_t>() | (uint64_t)die.fixed<uint8_t>() << 16; break;
+            case DW_FORM_addrx4: destination->value = die.fixed<uint32_t>(); break;
+            case DW_FORM_addrx:
+            case DW_FORM_GNU_addr_index:
+            case DW_FORM_rnglistx: destination->value = die.uleb128(); break;
+            default:
+                if (!read_unsigned_form(die, form, unit_encoding, destination->value)) return false;
+        }
+
+        destination->form = form;
+        return true;
+    });
+
+    if (!read || (encoding.address_size != 4 && encoding.address_size != 8)) return false;
+
+    // Reads the address at `index` in .debug_addr.
+    const auto indexed_address = [&](const uint64_t index, uintptr_t &address) {
+        const uint64_t offset = addr_base + index * encoding.address_size;
+        if (addr_base == 0 || offset >= _addr.size || _addr.size - offset < encoding.address_size) return false;
+
+        DwarfReader reader(_addr.data + offset, _addr.data + _addr.size, 0);
+        address = (encoding.address_size == 4) ? reader.fixed<uint32_t>() : reader.fixed<uint64_t>();
+        return true;
+    };
+
+    const auto address_value = [&](const Value &value, uintptr_t &address) {
+        switch (value.form) {
+            case DW_FORM_addr:
+                address = value.value;
+                return true;
+            case DW_FORM_addrx:
+            case DW_FORM_addrx1:
+            case DW_FORM_addrx2:
+            case DW_FORM_addrx3:
+            case DW_FORM_addrx4:
+            case DW_FORM_GNU_addr_index:
+                return indexed_address(value.value, address);
+            default:
+                return false;
+        }
+    };
+
+    const size_t range_count = _ranges.size();
+
+    const auto add_range = [&](const uintptr_t start, const uintptr_t end) {
+        if (end > start) {
+            _ranges.push_back({ .start = start, .end = end, .unit = unit_index });
+        }
+    };
+
+    uintptr_t base = 0;
+    const bool has_base = address_value(low_pc, base);
+
+    if (ranges.form == 0) {
+        if (!has_base || high_pc.form == 0) return false;
+
+        uintptr_t end;
+        if (!address_value(high_pc, end)) end = base + high_pc.value; // a length
+
+        add_range(base, end);
+    } else if (encoding.version < 5) {
+        // A .debug_ranges list: pairs of offsets from the base address, with a base address selection entry (an all-ones start) changing it.
+        if (ranges.value >= _ranges_section.size) return false;
+
+        DwarfReader list(_ranges_section.data + ranges.value, _ranges_section.data + _ranges_section.size, 0);
+        const uint64_t all_ones = (encoding.address_size == 4) ? UINT32_MAX : UINT64_MAX;
+
+        while (!list.error) {
+            const uint64_t start = (encoding.address_size == 4) ? list.fixed<uint32_t>() : list.fixed<uint64_t>();
+            const uint64_t end = (encoding.address_size == 4) ? list.fixed<uint32_t>() : list.fixed<uint64_t>();
+            if (list.error || (start == 0 && end == 0)) break;
+
+            if (start == all_ones) {
+                base = end;
+            } else {
+                add_range(base + start, base + end);
+            }
+        }
+    } else {
+        // A .debug_rnglists list, found directly or through the offset table at DW_AT_rnglists_base.
+        uint64_t offset = ranges.value;
+
+        if (ranges.form == DW_FORM_rnglistx) {
+            const size_t offset_size = encoding.dwarf64 ? 8 : 4;
+            const uint64_t entry = rnglists_base + ranges.value * offset_size;
+            if (rnglists_base == 0 || entry >= _rnglists.size || _rnglists.size - entry < offset_size) return false;
+
+            DwarfReader table(_rnglists.data + entry, _rnglists.data + _rnglists.size, 0);
+            offset = rnglists_base + table.offset(encoding.dwarf64);
+        }
+
+        if (offset >= _rnglists.size) return false;
+
+        DwarfReader list(_rnglists.data + offset, _rnglists.data + _rnglists.size, 0);
+        const auto read_address = [&list, &encoding]() -> uintptr_t {
+            return (encoding.address_size == 4) ? list.fixed<uint32_t>() : list.fixed<uint64_t>();
+        };
+
+        for (bool done = false; !done && !list.error;) {
+            uintptr_t start, end;
+
+            switch (list.fixed<uint8_t>()) {
+                case DW_RLE_end_of_list:
+                    done = true;
+                    break;
+                case DW_RLE_base_addressx:
+                    if (!indexed_address(list.uleb128(), base)) return _ranges.size() > range_count;
+                    break;
+                case DW_RLE_startx_endx: {
+                    const uint64_t start_index = list.uleb128(), end_index = list.uleb128();
+                    if (indexed_address(start_index, start) && indexed_address(end_index, end)) add_range(start, end);
+                    break;
+                }
+                case DW_RLE_startx_length: {
+                    const uint64_t start_index = list.uleb128(), length = list.uleb128();
+                    if (indexed_address(start_index, start)) add_range(start, start + length);
+                    break;
+                }
+                case DW_RLE_offset_pair: {
+                    const uint64_t start_offset = list.uleb128(), end_offset = list.uleb128();
+                    add_range(base + start_offset, base + end_offset);
+                    break;
+                }
+                case DW_RLE_base_address:
+                    base = read_address();
+                    break;
+                case DW_RLE_start_end:
+                    start = read_address();
+                    end = read_address();
+                    add_range(start, end);
+                    break;
+                case DW_RLE_start_length:
+                    start = read_address();
+                    add_range(start, start + list.uleb128());
+                    break;
+                default:
+                    // Nothing after an unknown entry can be found.
+                    done = true;
+            }
+        }
+    }
+
+    return _ranges.size() > range_count;
+}
+
+const char *LineTable::intern(const std::string &name) {
+    const std::lock_guard<std::mutex> lock(_files_mutex);
+    const auto [entry, inserted] = _file_names.try_emplace(name, nullptr);
+
+    if (inserted) {
+        entry->second = _file_name_arena.copy(name.c_str());
+    }
+
+    return entry->second;
+}
+
+void LineTable::decode(Unit &unit) {
+    // Find the unit's line program through the DW_AT_stmt_list attribute of its first DIE.
+    uint64_t stmt_list = UINT64_MAX;
+
+    const bool read = read_unit_die(unit.info_offset, [&stmt_list](const uint64_t attribute, const uint64_t form, DwarfReader &die, const Encoding &encoding) {
+        return attribute == DW_AT_stmt_list && read_unsigned_form(die, form, encoding, stmt_list);
+    });
+
+    if (!read) return;
+    if (stmt_list >= _line.size) return;
+
+    // Read the line program's header.
+    DwarfReader lines(_line.data + stmt_list, _line.data + _line.size, 0);
+    Encoding line_encoding;
+    DwarfReader program = lines.entry(&line_encoding.dwarf64);
+    line_encoding.version = program.fixed<uint16_t>();
+    line_encoding.address_size = sizeof (uintptr_t);
+
+    if (line_encoding.version < 2 || line_encoding.version > 5) return;
+
+    if (line_encoding.version >= 5) {
+        line_encoding.address_size = program.fixed<uint8_t>();
+        program.fixed<uint8_t>(); // segment selector size
+    }
+
+    const uint64_t header_length = program.offset(line_encoding.dwarf64);
+    if (program.error || header_length > (size_t)(program.end - program.position)) return;
+    const uint8_t *const program_start = program.position + header_length;
+
+    const uint8_t minimum_instruction_length = program.fixed<uint8_t>();
+    if (line_encoding.version >= 4) program.fixed<uint8_t>(); // maximum operations per instruction
+    program.fixed<uint8_t>(); // default is_stmt
+    const int8_t line_base = program.fixed<int8_t>();
+    const uint8_t line_range = program.fixed<uint8_t>();
+    const uint8_t opcode_base = program.fixed<uint8_t>();
+
+    if (program.error || line_range == 0 || opcode_base == 0) return;
+
+    std::vector<uint8_t> standard_opcode_lengths(opcode_base);
+    for (size_t i = 1; i < opcode_base; i++) {
+        standard_opcode_lengths[i] = program.fixed<uint8_t>();
+    }
+
+    // Before DWARF 5, directory 0 and file 0 are implicit (the compilation directory and primary source file), and the explicit ones are numbered from 1.
+    std::vector<std::string> directories;
+    std::vector<const char *> &files = unit.files;
+
+    if (line_encoding.version < 5) {
+        directories.push_back("");
+        files.push_back(nullptr);
+
+        for (;;) {
+            const char *const directory = program.string();
+            if (program.error || directory[0] == '\0') break;
+            directories.push_back(directory);
+        }
+
+        for (;;) {
+            const char *const name = program.string();
+            if (program.error || name[0] == '\0') break;
+
+            const uint64_t directory = program.uleb128();
+            program.uleb128(); // modification time
+            program.uleb128(); // length
+
+            files.push_back(intern(join_path(directory < directories.size() ? directories[directory] : "", name)));
+        }
+    } else {
+        // Reads a list of entries, each of which is described by the same list of (content type, form) pairs, calling `entry(path, directory index)` for each.
+        const auto read_entries = [&](const std::function<void (const char *, uint64_t)> &entry) {
+            std::vector<std::pair<uint64_t, uint64_t>> format(program.fixed<uint8_t>());
+            for (auto &[type, form] : format) {
+                type = program.uleb128();
+                form = program.uleb128();
+            }
+
+            const uint64_t count = program.uleb128();
+
+            for (uint64_t i = 0; i < count && !program.error; i++) {
+                const char *path = "";
+                uint64_t directory = 0;
+
+                for (const auto &[type, form] : format) {
+                    if (type == DW_LNCT_path && form == DW_FORM_string) {
+                        path = program.string();
+                    } else if (type == DW_LNCT_path && (form == DW_FORM_line_strp || form == DW_FORM_strp)) {
+                        const Section &strings = (form == DW_FORM_line_strp) ? _line_str : _str;
+                        const uint64_t offset = program.offset(line_encoding.dwarf64);
+
+                        if (strings.data != nullptr && offset < strings.size && memchr(strings.data + offset, '\0', strings.size - offset) != nullptr) {
+                            path = (const char *)strings.data + offset;
+                        }
+                    } else if (type == DW_LNCT_directory_index && read_unsigned_form(program, form, line_encoding, directory)) {
+                        // Got it.
+                    } else if (!skip_form(program, form, line_encoding)) {
+                        program.error = true;
+                        return;
+                    }
+                }
+
+                entry(path, directory);
+            }
+        };
+
+        read_entries([&](const char *const path, uint64_t) {
+            directories.push_back(path);
+        });
+
+        read_entries([&](const char *const path, const uint64_t directory) {
+            files.push_back(intern(join_path(directory < directories.size() ? directories[directory] : "", path)));
+        });
+    }
+
+    if (program.error || program_start > program.end) return;
+    program.skip(program_start - program.position);
+
+    // Run the line number program.  We only track the registers that say where each row is.
+    std::vector<Row> &rows = unit.rows;
+    uintptr_t address = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+
+    const auto emit = [&](const bool end) {
+        rows.push_back({ .address = address, .file = (uint32_t)std::min(file, (uint64_t)UINT32_MAX), .line = end ? 0 : (uint32_t)std::clamp(line, (int64_t)0, (int64_t)UINT32_MAX) });
+    };
+
+    while (program.position < program.end && !program.error) {
+        const uint8_t opcode = program.fixed<uint8_t>();
+
+        if (opcode >= opcode_base) {
+            const uint8_t adjusted = opcode - opcode_base;
+            address += (adjusted / line_range) * minimum_instruction_length;
+            line += line_base + adjusted % line_range;
+            emit(false);
+            continue;
+        }
+
+        switch (opcode) {
+            case 0: { // extended
+                const uint64_t length = program.uleb128();
+                if (length == 0 || length > (size_t)(program.end - program.position)) {
+                    program.error = true;
+                    break;
+                }
+
+                const uint8_t *const next = program.position + length;
+                const uint8_t extended_opcode = program.fixed<uint8_t>();
+
+                if (extended_opcode == DW_LNE_end_sequence) {
+                    emit(true);
+                    address = 0;
+                    file = 1;
+                    line = 1;
+                } else if (extended_opcode == DW_LNE_set_address && length - 1 == sizeof (uintptr_t)) {
+                    address = program.fixed<uintptr_t>();
+                }
+
+                program.skip(next - program.position);
+                break;
+            }
+            case DW_LNS_copy:
+                emit(false);
+                break;
+            case DW_LNS_advance_pc:
+                address += program.uleb128() * minimum_instruction_length;
+                break;
+            case DW_LNS_advance_line:
+                line += program.sleb128();
+                break;
+            case DW_LNS_set_file:
+                file = program.uleb128();
+                break;
+            case DW_LNS_const_add_pc:
+                address += ((255 - opcode_base) / line_range) * minimum_instruction_length;
+                break;
+            case DW_LNS_fixed_advance_pc:
+                address += program.fixed<uint16_t>();
+                break;
+            default:
+                // Other standard opcodes just set registers we don't track.
+                for (uint8_t i = 0; i < standard_opcode_lengths[opcode]; i++) {
+                    program.uleb128();
+                }
+                break;
+        }
+    }
+
+    // Sequences can be in any order.  A row applies until the next one starts, so where rows share an address, the last one wins, except that the end of one sequence yields to the start of another.
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        if (a.address != b.address) return a.address < b.address;
+        return a.line == 0 && b.line != 0;
+    });
+
+    size_t count = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (i + 1 < rows.size() && rows[i + 1].address == rows[i].address) continue;
+        rows[count++] = rows[i];
+    }
+
+    rows.resize(count);
+    rows.shrink_to_fit();
+}
+
+bool LineTable::find(const uintptr_t address, const char *&file, unsigned int &line) {
+    const auto range = std::upper_bound(_ranges.begin(), _ranges.end(), address, [](const uintptr_t address, const Range &range) {
+        return address < range.start;
+    });
+
+    if (range == _ranges.begin() || address >= (range - 1)->end) return false;
+
+    Unit &unit = _units[(range - 1)->unit];
+    std::call_once(*unit.decoded, &LineTable::decode, this, std::ref(unit));
+
+    const auto row = std::upper_bound(unit.rows.begin(), unit.rows.end(), address, [](const uintptr_t address, const Row &row) {
+        return address < row.address;
+    });
+
+    // A line of 0 is either the end of a sequence or code (e.g., compiler-generated) with no line.
+    if (row == unit.rows.begin() || (row - 1)->line == 0 || (row - 1)->file >= unit.files.size() || unit.files[(row - 1)->file] == nullptr) return false;
+
+    file = unit.files[(row - 1)->file];
+    line = (row - 1)->line;
+
+    return true;
+}
+
+bool LineTable::empty() const {
+    return _ranges.empty();
+}
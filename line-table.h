@@ -0,0 +1,84 @@
+//
+//  line-table.h
+//  drspin
+//
+
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+// Maps addresses in an ELF object to source lines, using its DWARF .debug_line.
+//
+// Decoding all of a large object's line programs would take far longer than symbolicating a profile, so only .debug_aranges (which says which compilation unit covers each address) is read up front, or without it, the address ranges in each unit's first DIE.  A unit's line program is decoded, into a compact sorted table, the first time an address in it is looked up.
+struct LineTable : private DeleteImplicit {
+    // Reads the debug info of the object at `path` (or of its separate debug file, if it has one, found by `build_id` or path).  The table is empty if there isn't any.
+    LineTable(const std::string &path, const std::string &build_id);
+
+    // Looks up an unslid address.  Returns false if it has no line.  Safe to call concurrently.
+    bool find(uintptr_t address, const char *&file, unsigned int &line);
+
+    // Whether the object has any line info at all.
+    bool empty() const;
+private:
+    struct Row {
+        uintptr_t address;
+        uint32_t file; // an index into the unit's files
+        uint32_t line; // 0 at the end of a sequence
+    };
+
+    struct Unit {
+        uint64_t info_offset; // of the unit's header in .debug_info
+        std::unique_ptr<std::once_flag> decoded;
+        std::vector<const char *> files;
+        std::vector<Row> rows;
+    };
+
+    struct Range {
+        uintptr_t start;
+        uintptr_t end;
+        size_t unit;
+    };
+
+    struct Section {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    bool load(const std::string &path);
+    void read_aranges();
+
+    // Adds the address ranges given by the unit's first DIE to `_ranges`.  Returns false if there aren't any.
+    bool read_unit_ranges(size_t unit_index);
+
+    // Calls `visit(attribute, form, reader, encoding)` for each attribute of the first DIE of the unit at `info_offset`, with `reader` at the attribute's value.  `visit` returns whether it read the value; if not, it's skipped.  Returns false if the DIE couldn't be read.
+    template<typename Visitor>
+    bool read_unit_die(uint64_t info_offset, Visitor visit);
+
+    void decode(Unit &unit);
+
+    // Returns the single, shared copy of a file name.
+    const char *intern(const std::string &name);
+
+    std::unique_ptr<const MappedFile> _file;
+    Section _info, _abbrev, _line, _str, _line_str, _aranges, _addr, _ranges_section, _rnglists;
+
+    std::vector<Unit> _units;
+
+    // Sorted by start.
+    std::vector<Range> _ranges;
+
+    // File names, each stored once no matter how many units refer to it.
+    std::mutex _files_mutex;
+    std::unordered_map<std::string, const char *> _file_names;
+    StringArena _file_name_arena;
+};
+
+#endif /* LINE_TABLE_H */
@@ -0,0 +1,293 @@
+//
+//  linux-sampler.cpp
+//  drspin
+//
+
+#include "linux-sampler.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <elf.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+LinuxSampler::LinuxSampler(const pid_t pid)
+: _pid(pid), _clock_ticks(sysconf(_SC_CLK_TCK)) { }
+
+LinuxSampler::~LinuxSampler() {
+    for (const auto [lwpid, files] : _stat_fds) {
+        close(files.stat);
+        if (files.schedstat != -1) close(files.schedstat);
+    }
+}
+
+std::string LinuxSampler::process_name() {
+    const std::string path = std::string("/proc/") + std::to_string(_pid) + "/comm";
+    FILE *const file = fopen(path.c_str(), "r");
+    assert(file != NULL);
+
+    char name[64] = "";
+    char *const line = fgets(name, sizeof (name), file);
+    assert(line != NULL);
+    fclose(file);
+
+    name[strcspn(name, "\n")] = '\0';
+    return name;
+}
+
+std::vector<lwpid_t> LinuxSampler::list_tasks() {
+    const std::string path = std::string("/proc/") + std::to_string(_pid) + "/task";
+    DIR *const dir = opendir(path.c_str());
+    std::vector<lwpid_t> lwpids;
+
+    // The process might have exited.
+    _syscalls.add("opendir(/proc/<pid>/task)");
+    if (dir == NULL) return lwpids;
+
+    while (const struct dirent *const entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            lwpids.push_back(atoi(entry->d_name));
+        }
+    }
+
+    closedir(dir);
+    std::sort(lwpids.begin(), lwpids.end());
+
+    return lwpids;
+}
+
+std::vector<LinuxSampler::TracedThread>::iterator LinuxSampler::find_thread(const lwpid_t lwpid) {
+    return std::lower_bound(_threads.begin(), _threads.end(), lwpid, [](const TracedThread &thread, const lwpid_t lwpid) {
+        return thread.lwpid < lwpid;
+    });
+}
+
+bool LinuxSampler::seize(const lwpid_t lwpid) {
+    const long rv = ptrace(PTRACE_SEIZE, lwpid, 0, 0);
+    const int error = errno; // before counting the call, which may allocate
+    _syscalls.add("ptrace(PTRACE_SEIZE)");
+
+    // The thread might have exited since we listed it.
+    assert(!rv || error == ESRCH);
+
+    if (!rv) {
+        _threads.insert(find_thread(lwpid), { .lwpid = lwpid, .listening = false });
+    }
+
+    return !rv;
+}
+
+bool LinuxSampler::wait_for_thread(TracedThread &thread) {
+    for (;;) {
+        int status;
+        const pid_t waited_pid = waitpid(thread.lwpid, &status, __WALL);
+        const int error = errno;
+        _syscalls.add("waitpid");
+
+        if (waited_pid == -1) {
+            assert(error == ECHILD);
+            return false;
+        } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            return false;
+        }
+
+        assert(waited_pid == thread.lwpid);
+        assert(WIFSTOPPED(status));
+
+        const int event = status >> 16;
+        const int signo = WSTOPSIG(status);
+
+        if (event == PTRACE_EVENT_STOP) {
+            // This is either our interrupt (SIGTRAP) or a group-stop (the stop signal).
+            thread.listening = (signo != SIGTRAP);
+            return true;
+        }
+
+        // A signal arrived before our interrupt did.  Deliver it; the interrupt is still pending, so the thread will stop again shortly.
+        const long rv = ptrace(PTRACE_CONT, thread.lwpid, 0, event == 0 ? signo : 0);
+        const int cont_error = errno;
+        _syscalls.add("ptrace(PTRACE_CONT)");
+        assert(!rv || cont_error == ESRCH);
+    }
+}
+
+void LinuxSampler::attach() {
+    const bool seized = seize(_pid);
+    assert(seized);
+
+    stop();
+}
+
+void LinuxSampler::read_thread_states() {
+    const std::vector<lwpid_t> lwpids = list_tasks();
+    _thread_states.clear();
+
+    // Close the files of threads that have exited.
+    for (auto iter = _stat_fds.begin(); iter != _stat_fds.end();) {
+        if (std::binary_search(lwpids.begin(), lwpids.end(), iter->first)) {
+            iter++;
+        } else {
+            close(iter->second.stat);
+            if (iter->second.schedstat != -1) close(iter->second.schedstat);
+            iter = _stat_fds.erase(iter);
+        }
+    }
+
+    for (const lwpid_t lwpid : lwpids) {
+        auto entry = _stat_fds.find(lwpid);
+
+        if (entry == _stat_fds.end()) {
+            const std::string directory = std::string("/proc/") + std::to_string(_pid) + "/task/" + std::to_string(lwpid);
+            const int fd = open((directory + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+            _syscalls.add("open(/proc/<pid>/task/<tid>/stat)");
+
+            // The thread might have exited since we listed it.
+            if (fd == -1) continue;
+
+            const int schedstat_fd = open((directory + "/schedstat").c_str(), O_RDONLY | O_CLOEXEC);
+            _syscalls.add("open(/proc/<pid>/task/<tid>/schedstat)");
+
+            entry = _stat_fds.emplace(lwpid, StatFiles { .stat = fd, .schedstat = schedstat_fd }).first;
+        }
+
+        char buffer[512];
+        const ssize_t length = pread(entry->second.stat, buffer, sizeof (buffer) - 1, 0);
+        _syscalls.add("pread(/proc/<pid>/task/<tid>/stat)");
+        if (length <= 0) continue;
+        buffer[length] = '\0';
+
+        // The fields after the command name (which is in parentheses, and may itself contain spaces and parentheses) start with the state (field 3); user and system time are fields 14 and 15.
+        const char *const fields = strrchr(buffer, ')');
+        char state;
+        unsigned long long user_time, system_time;
+
+        if (fields == NULL || sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &state, &user_time, &system_time) != 3) continue;
+
+        // A thread we've resumed but that hasn't been scheduled yet is still in tracing stop ("t"), but it's really waiting to run -- unless somebody else stopped the target.
+        const auto traced = find_thread(lwpid);
+        const bool resumed = (state == 't' && traced != _threads.end() && traced->lwpid == lwpid && !traced->listening);
+
+        // The time spent on a CPU, the first field of schedstat, is in nanoseconds; stat's times are only as fine as the clock tick (usually 10 ms), which is coarser than the sampling interval.
+        uint64_t cpu_time = (user_time + system_time) * (1000000000 / _clock_ticks);
+
+        if (entry->second.schedstat != -1) {
+            char schedstat[128];
+            const ssize_t schedstat_length = pread(entry->second.schedstat, schedstat, sizeof (schedstat) - 1, 0);
+            _syscalls.add("pread(/proc/<pid>/task/<tid>/schedstat)");
+            unsigned long long run_time;
+
+            if (schedstat_length > 0) {
+                schedstat[schedstat_length] = '\0';
+                if (sscanf(schedstat, "%llu", &run_time) == 1) cpu_time = run_time;
+            }
+        }
+
+        _thread_states[lwpid] = {
+            .on_cpu = (state == 'R' || resumed),
+            .cpu_time = cpu_time,
+        };
+    }
+}
+
+void LinuxSampler::request_stop() {
+    // Pick up any threads created since the last stop.
+    for (const lwpid_t lwpid : list_tasks()) {
+        const auto position = find_thread(lwpid);
+
+        if (position == _threads.end() || position->lwpid != lwpid) {
+            seize(lwpid);
+        }
+    }
+
+    for (const TracedThread &thread : _threads) {
+        const long rv = ptrace(PTRACE_INTERRUPT, thread.lwpid, 0, 0);
+        const int error = errno;
+        _syscalls.add("ptrace(PTRACE_INTERRUPT)");
+        assert(!rv || error == ESRCH);
+    }
+}
+
+void LinuxSampler::wait_for_stop() {
+    // Forget threads that have exited.
+    _threads.erase(std::remove_if(_threads.begin(), _threads.end(), [this](TracedThread &thread) {
+        return !wait_for_thread(thread);
+    }), _threads.end());
+}
+
+void LinuxSampler::resume() {
+    for (const TracedThread &thread : _threads) {
+        const long rv = ptrace(thread.listening ? PTRACE_LISTEN : PTRACE_CONT, thread.lwpid, 0, 0);
+        const int error = errno;
+        _syscalls.add(thread.listening ? "ptrace(PTRACE_LISTEN)" : "ptrace(PTRACE_CONT)");
+        assert(!rv || error == ESRCH);
+    }
+}
+
+void LinuxSampler::detach() {
+    for (const TracedThread &thread : _threads) {
+        const long rv = ptrace(PTRACE_DETACH, thread.lwpid, 0, 0);
+        const int error = errno;
+        _syscalls.add("ptrace(PTRACE_DETACH)");
+        assert(!rv || error == ESRCH);
+    }
+
+    _threads.clear();
+}
+
+std::vector<lwpid_t> LinuxSampler::threads() {
+    std::vector<lwpid_t> lwpids;
+
+    for (const TracedThread &thread : _threads) {
+        lwpids.push_back(thread.lwpid);
+    }
+
+    return lwpids;
+}
+
+Registers LinuxSampler::registers(const lwpid_t lwpid) {
+#if defined(__x86_64__) && __x86_64__
+    struct user_regs_struct regs;
+    const long rv = ptrace(PTRACE_GETREGS, lwpid, 0, &regs);
+    _syscalls.add("ptrace(PTRACE_GETREGS)");
+    assert(!rv);
+
+    return { .pc = (uintptr_t)regs.rip, .fp = (uintptr_t)regs.rbp, .sp = (uintptr_t)regs.rsp, .lr = 0 };
+#elif defined(__aarch64__) && __aarch64__
+    struct user_regs_struct regs;
+    struct iovec iov = { .iov_base = &regs, .iov_len = sizeof (regs) };
+    const long rv = ptrace(PTRACE_GETREGSET, lwpid, (void *)NT_PRSTATUS, &iov);
+    _syscalls.add("ptrace(PTRACE_GETREGSET)");
+    assert(!rv);
+
+    // x29 is the frame pointer by convention, and x30 is the link register.
+    return { .pc = (uintptr_t)regs.pc, .fp = (uintptr_t)regs.regs[29], .sp = (uintptr_t)regs.sp, .lr = (uintptr_t)regs.regs[30] };
+#else
+#error don't know how to get pc/fp/sp
+#endif
+}
+
+size_t LinuxSampler::read(const uintptr_t address, void *const buffer, const size_t size) {
+    const struct iovec local = { .iov_base = buffer, .iov_len = size };
+    const struct iovec remote = { .iov_base = (void *)address, .iov_len = size };
+
+    // process_vm_readv() stops at the first fault, returning a short count (or -1 if nothing could be read).
+    const ssize_t count = process_vm_readv(_pid, &local, 1, &remote, 1, 0);
+    const int error = errno;
+    _syscalls.add("process_vm_readv");
+    assert(count >= 0 || error == EFAULT || error == ESRCH);
+
+    return count > 0 ? count : 0;
+}
@@ -0,0 +1,56 @@
+//
+//  linux-sampler.h
+//  drspin
+//
+
+#include "sampler.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef LINUX_SAMPLER_H
+#define LINUX_SAMPLER_H
+
+struct LinuxSampler : public Sampler {
+    LinuxSampler(pid_t pid);
+    ~LinuxSampler();
+    std::string process_name();
+    void attach();
+    void read_thread_states();
+    void request_stop();
+    void wait_for_stop();
+    void resume();
+    void detach();
+    std::vector<lwpid_t> threads();
+    Registers registers(lwpid_t lwpid);
+    size_t read(uintptr_t address, void *buffer, size_t size);
+private:
+    // On Linux, ptrace operates on individual threads rather than on the process, so we track the threads we've seized.
+    struct TracedThread {
+        lwpid_t lwpid;
+
+        // Whether the thread is in a group-stop (e.g., somebody else sent the target SIGSTOP), in which case we must resume it with PTRACE_LISTEN rather than PTRACE_CONT.
+        bool listening;
+    };
+
+    std::vector<lwpid_t> list_tasks();
+
+    // Returns the position of the thread in `_threads` (which is sorted by LWP ID), or where it would go.
+    std::vector<TracedThread>::iterator find_thread(lwpid_t lwpid);
+    bool seize(lwpid_t lwpid);
+    bool wait_for_thread(TracedThread &thread);
+    pid_t _pid;
+    std::vector<TracedThread> _threads;
+
+    // Each thread's /proc/<pid>/task/<tid>/stat (for its state) and schedstat (for its CPU time, in nanoseconds), kept open so that reading them again is a single pread() each.  The schedstat fd is -1 if the kernel doesn't provide it, in which case the CPU time comes from stat, in clock ticks.
+    struct StatFiles {
+        int stat;
+        int schedstat;
+    };
+
+    std::unordered_map<lwpid_t, StatFiles> _stat_fds;
+    long _clock_ticks; // per second, the unit of CPU times in stat
+};
+
+#endif /* LINUX_SAMPLER_H */
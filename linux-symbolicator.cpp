@@ -0,0 +1,47 @@
+//
+//  linux-symbolicator.cpp
+//  drspin
+//
+
+#include "linux-symbolicator.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <sys/types.h>
+
+LinuxSymbolicator::LinuxSymbolicator(const pid_t pid) {
+    _pid = pid;
+
+    // There's no need to walk the dynamic linker's data structures: /proc/<pid>/maps lists every mapped file, in address order.
+    const std::string maps_path = std::string("/proc/") + std::to_string(pid) + "/maps";
+    FILE *const maps = fopen(maps_path.c_str(), "r");
+    assert(maps != NULL);
+
+    std::set<std::string> seen_paths;
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    while (getline(&line, &line_cap, maps) != -1) {
+        uintptr_t start, end, offset;
+        int path_index = 0;
+        const int matched = sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %*s %" SCNxPTR " %*s %*s %n", &start, &end, &offset, &path_index);
+        assert(matched == 3);
+
+        char *const path = line + path_index;
+        path[strcspn(path, "\n")] = '\0';
+
+        // Skip anonymous and special mappings (e.g., "[stack]"), files that have since been deleted, all but the first mapping of each file, and non-ELF files (e.g., locale archives).
+        if (path[0] != '/' || strstr(path, " (deleted)") != NULL || offset != 0 || !seen_paths.insert(path).second || !is_elf(path)) {
+            continue;
+        }
+
+        add_library(path, start);
+    }
+
+    free(line);
+    fclose(maps);
+}
@@ -0,0 +1,18 @@
+//
+//  linux-symbolicator.h
+//  drspin
+//
+
+#include "elf-symbolicator.h"
+#include <sys/types.h>
+
+#ifndef LINUX_SYMBOLICATOR_H
+#define LINUX_SYMBOLICATOR_H
+
+struct LinuxSymbolicator : public ELFSymbolicator {
+    LinuxSymbolicator(pid_t pid);
+private:
+    pid_t _pid;
+};
+
+#endif /* LINUX_SYMBOLICATOR_H */
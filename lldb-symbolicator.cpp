@@ -8,86 +8,119 @@
 #include "lldb-symbolicator.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
 #include <sys/types.h>
 
-LLDBSymbolicator::LLDBSymbolicator(const pid_t pid) {
+LLDBSymbolicator::LLDBSymbolicator(const pid_t pid)
+: _line(NULL), _line_cap(0) {
     const std::string lldb_command = std::string("/usr/bin/lldb -p ") + std::to_string(pid);
     _connection = popen(lldb_command.c_str(), "r+");
 
+    // Bidirectional popen() is a BSD extension.
+    if (_connection == NULL) {
+        fprintf(stderr, "drspin: couldn't start lldb\n");
+        exit(1);
+    }
+
     // Read the prologue.  (TODO: less hacky way?)
     for (int i = 0; i < 5; i++) {
-        size_t line_len;
-        char *const line = fgetln(_connection, &line_len);
-        assert(line != NULL);
+        const ssize_t line_len = getline(&_line, &_line_cap, _connection);
+        assert(line_len != -1);
 #if 0
-        line[line_len - 1] = '\0';
-        fprintf(stderr, "discarded: %s\n", line);
+        _line[line_len - 1] = '\0';
+        fprintf(stderr, "discarded: %s\n", _line);
 #endif /* 0 */
     }
 }
 
-std::string LLDBSymbolicator::symbolicate(const uintptr_t address) {
-    if (address == 0) return std::string("...");
+Symbol LLDBSymbolicator::symbolicate(const uintptr_t address) {
+    return symbolicate_batch({ address })[0];
+}
 
-    std::string result = "???";
-    const auto entry = _cache.find(address);
+std::vector<Symbol> LLDBSymbolicator::symbolicate_batch(const std::vector<uintptr_t> &addresses) {
+    std::vector<Symbol> symbols(addresses.size(), { .description = "???", .function = "", .library = "" });
+    std::unordered_map<uintptr_t, Symbol> results;
+    bool any = false;
 
-    if (entry != _cache.end()) {
-        result = entry->second;
-    } else {
-        char buf[48];
-        sprintf(buf, "%#lx", address);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i] == 0) {
+            symbols[i] = { .description = "...", .function = "...", .library = "" };
+        } else {
+            any = true;
+        }
+    }
 
-        // NOTE: the second (pointless) command is so we can tell when the output from the first command is over and can return without leaving stale input in the buffer.
-        const std::string command = std::string("image look -a ") + buf + "\np (void)0\n";
+    if (!any) return symbols;
 
-#if 0
-        fprintf(stderr, "writing: %s\n", command.c_str());
-#endif /* 0 */
-        fputs(command.c_str(), _connection);
+    // Write all the commands from another thread (through another descriptor for the same connection), so that LLDB never blocks on a full pipe while we're blocked writing to it.
+    std::thread writer([this, &addresses]() {
+        FILE *const commands = fdopen(dup(fileno(_connection)), "w");
+        assert(commands != NULL);
 
-        // Discard the echo.  (TODO: less hacky way?)
-        for (int i = 0; i < 1; i++) {
-            size_t line_len;
-            char *const line = fgetln(_connection, &line_len);
-            assert(line != NULL);
+        for (const uintptr_t address : addresses) {
+            if (address != 0) {
 #if 0
-            line[line_len - 1] = '\0';
-            fprintf(stderr, "discarded: %s\n", line);
+                fprintf(stderr, "writing: image look -a %#lx\n", address);
 #endif /* 0 */
+                fprintf(commands, "image look -a %#lx\n", address);
+            }
         }
 
-        for (;;) {
-            size_t line_len;
-            char *const line = fgetln(_connection, &line_len);
+        // NOTE: the last (pointless) command is so we can tell when the output from the lookups is over and can return without leaving stale input in the buffer.
+        fputs("p (void)0\n", commands);
+        fclose(commands);
+    });
+
+    // LLDB echoes each command after its prompt, so the echo of a lookup says which address the following summary is for.  Anything before the first echo is left over from the previous batch.
+    uintptr_t address = 0;
+
+    for (;;) {
+        const ssize_t line_len = getline(&_line, &_line_cap, _connection);
+        char *const line = _line;
+
+        if (line_len == -1 || line[line_len - 1] != '\n') break;
+        line[line_len - 1] = '\0';
 
-            if (line == NULL) {
-                break;
-            } else {
-                if (line[line_len - 1] == '\n') {
-                    line[line_len - 1] = '\0';
 #if 0
-                    fprintf(stderr, "read: %s\n", line);
+        fprintf(stderr, "read: %s\n", line);
 #endif /* 0 */
-                    const char *const needle = strstr(line, "Summary: ");
-
-                    if (needle != NULL) {
-                        result = std::string(needle + 9);
-                        // We've got our result, but keep looping until we get the prompt.
-                    } else if (!strncmp(line, "(lldb)", 6)) {
-                        break;
-                    }
-                } else {
-                    break;
-                }
+
+        if (!strncmp(line, "(lldb)", 6)) {
+            const char *command = line + 6;
+            while (*command == ' ') command++;
+
+            if (!strncmp(command, "image look -a ", 14)) {
+                address = strtoul(command + 14, NULL, 0);
+            } else if (!strncmp(command, "p (void)0", 9)) {
+                break;
+            }
+        } else if (const char *const needle = strstr(line, "Summary: "); needle != NULL && address != 0) {
+            // The summary looks like "libc.so.7`__sys_nanosleep + 12".
+            Symbol &result = results[address];
+            result.description = std::string(needle + 9);
+
+            const size_t backtick = result.description.find('`');
+            if (backtick != std::string::npos) {
+                result.library = result.description.substr(0, backtick);
+                result.function = result.description.substr(backtick + 1, result.description.find(" + ", backtick) - backtick - 1);
             }
         }
+    }
+
+    writer.join();
 
-        _cache[address] = result;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        const auto entry = results.find(addresses[i]);
+        if (entry != results.end()) symbols[i] = entry->second;
     }
 
-    return result;
+    return symbols;
 }
 
 LLDBSymbolicator::~LLDBSymbolicator() {
@@ -95,4 +128,5 @@ LLDBSymbolicator::~LLDBSymbolicator() {
     printf("closing connection %p\n", _connection);
 #endif /* 0 */
     pclose(_connection);
+    free(_line);
 }
@@ -9,20 +9,26 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <sys/types.h>
 
 #ifndef LLDB_SYMBOLICATOR_H
 #define LLDB_SYMBOLICATOR_H
 
+// Symbolicates by driving an LLDB attached to the target.  It doesn't cache anything itself; wrap it in a CachingSymbolicator.
 struct LLDBSymbolicator : public Symbolicator, private DeleteImplicit {
     LLDBSymbolicator(pid_t pid);
-    std::string symbolicate(uintptr_t address);
+    Symbol symbolicate(uintptr_t address);
+
+    // Pipelines the lookups for all the addresses through LLDB at once, rather than waiting for each answer before asking the next question.
+    std::vector<Symbol> symbolicate_batch(const std::vector<uintptr_t> &addresses);
     ~LLDBSymbolicator();
 private:
-    std::unordered_map<uintptr_t, std::string> _cache;
     FILE *_connection;
+
+    // getline() buffer for reading from the connection.
+    char *_line;
+    size_t _line_cap;
 };
 
 #endif /* LLDB_SYMBOLICATOR_H */
@@ -0,0 +1,27 @@
+//
+//  offline-symbolicator.cpp
+//  drspin
+//
+
+#include "offline-symbolicator.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+OfflineSymbolicator::OfflineSymbolicator(const std::vector<LoadedLibrary> &libraries, const std::string &sysroot) {
+    for (const LoadedLibrary &library : libraries) {
+        const std::string path = sysroot + library.path;
+
+        if (!is_elf(path.c_str())) {
+            fprintf(stderr, "drspin: warning: can't find %s; its addresses won't be symbolicated\n", path.c_str());
+            continue;
+        }
+
+        const Library &added = add_library(path, library.load_address);
+
+        if (added.build_id() != library.build_id) {
+            fprintf(stderr, "drspin: warning: %s has changed since it was recorded (build ID %s, not %s); its symbols may be wrong\n",
+                    path.c_str(), added.build_id().empty() ? "none" : added.build_id().c_str(), library.build_id.empty() ? "none" : library.build_id.c_str());
+        }
+    }
+}
@@ -0,0 +1,18 @@
+//
+//  offline-symbolicator.h
+//  drspin
+//
+
+#include "elf-symbolicator.h"
+#include <string>
+#include <vector>
+
+#ifndef OFFLINE_SYMBOLICATOR_H
+#define OFFLINE_SYMBOLICATOR_H
+
+// Symbolicates a capture's addresses using the library map it recorded, rather than a live process.  Each library is looked for at its recorded path under `sysroot` (e.g., a copy of the target machine's filesystem); libraries that are missing, or whose build IDs no longer match, are reported on stderr.
+struct OfflineSymbolicator : public ELFSymbolicator {
+    OfflineSymbolicator(const std::vector<LoadedLibrary> &libraries, const std::string &sysroot);
+};
+
+#endif /* OFFLINE_SYMBOLICATOR_H */
@@ -0,0 +1,102 @@
+//
+//  overhead.cpp
+//  drspin
+//
+
+#include "overhead.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static double microseconds(const uint64_t nanoseconds) {
+    return nanoseconds / 1e3;
+}
+
+OverheadMonitor::OverheadMonitor()
+: _mark(0), _sample_start(0), _sample_phase_times(), _sample_phase_ended(), _start_time(0), _end_time(0), _stopped_time(0), _window_start(0), _window_stopped_time(0) { }
+
+void OverheadMonitor::begin_sample() {
+    _mark = monotonic_time();
+    _sample_start = _mark;
+
+    if (_start_time == 0) {
+        _start_time = _mark;
+        _window_start = _mark;
+    }
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        _sample_phase_times[i] = 0;
+        _sample_phase_ended[i] = false;
+    }
+}
+
+void OverheadMonitor::end_phase(const Phase phase) {
+    const uint64_t now = monotonic_time();
+
+    _sample_phase_times[phase] += now - _mark;
+    _sample_phase_ended[phase] = true;
+    _mark = now;
+}
+
+void OverheadMonitor::end_sample() {
+    // Phases that didn't happen in this sample (e.g., stopping, for the first sample, which attaching stops for) aren't counted as taking no time.
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (_sample_phase_ended[i]) {
+            _phase_times[i].add(_sample_phase_times[i]);
+        }
+    }
+
+    const uint64_t sample_time = _mark - _sample_start;
+    _sample_times.add(sample_time);
+    _stopped_time += sample_time;
+    _window_stopped_time += sample_time;
+    _end_time = _mark;
+}
+
+double OverheadMonitor::window_stopped_fraction(const uint64_t window) {
+    const uint64_t elapsed = _end_time - _window_start;
+    if (elapsed < window) return -1;
+
+    const double fraction = (double)_window_stopped_time / elapsed;
+    _window_start = _end_time;
+    _window_stopped_time = 0;
+
+    return fraction;
+}
+
+const char *OverheadMonitor::phase_name(const Phase phase) {
+    switch (phase) {
+        case PHASE_STOP: return "stop";
+        case PHASE_WAIT: return "wait";
+        case PHASE_ENUMERATE: return "enumerate";
+        case PHASE_REGISTERS: return "registers";
+        case PHASE_UNWIND: return "unwind";
+        case PHASE_RESUME: return "resume";
+        case PHASE_COUNT: break;
+    }
+
+    abort();
+}
+
+void OverheadMonitor::print_statistics(const SyscallCounts &syscalls) const {
+    const uint64_t samples = _sample_times.count();
+    const uint64_t elapsed = _end_time - _start_time;
+
+    printf("  %-12s %10s %10s %10s %10s\n", "Phase (us)", "p50", "p99", "max", "total");
+
+    const auto print_histogram = [](const char *const name, const Histogram &histogram) {
+        printf("  %-12s %10.1f %10.1f %10.1f %10.1f\n", name,
+            microseconds(histogram.percentile(50)), microseconds(histogram.percentile(99)),
+            microseconds(histogram.max()), microseconds(histogram.sum()));
+    };
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        print_histogram(phase_name((Phase)i), _phase_times[i]);
+    }
+
+    print_histogram("sample", _sample_times);
+
+    printf("  Target stopped for at most %.1f%% of %.3f seconds (%llu samples)\n", elapsed > 0 ? 100.0 * _stopped_time / elapsed : 0, elapsed / 1e9, (unsigned long long)samples);
+    printf("  Syscalls: %llu\n", (unsigned long long)syscalls.total());
+    syscalls.print(samples);
+    printf("\n");
+}
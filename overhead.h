@@ -0,0 +1,62 @@
+//
+//  overhead.h
+//  drspin
+//
+
+#include "histogram.h"
+#include "sampler.h"
+#include "util.h"
+#include <stdint.h>
+
+#ifndef OVERHEAD_H
+#define OVERHEAD_H
+
+// Times the phases of each sample, to measure how much drspin slows down the target.
+//
+// A sample is timed from the moment we ask the target to stop until it has been resumed, which is an upper bound on how long it was actually stopped (its threads are still running while the stop is delivered).
+struct OverheadMonitor : private DeleteImplicit {
+    enum Phase {
+        PHASE_STOP,         // sending the stop request
+        PHASE_WAIT,         // waiting for the target to stop
+        PHASE_ENUMERATE,    // listing its threads
+        PHASE_REGISTERS,    // fetching each thread's registers
+        PHASE_UNWIND,       // unwinding each thread's stack
+        PHASE_RESUME,       // resuming the target
+        PHASE_COUNT,
+    };
+
+    OverheadMonitor();
+
+    // Starts timing a sample.
+    void begin_sample();
+
+    // Charges the time since the last mark to `phase`.  A phase may be ended several times per sample (e.g., once per thread); its times add up.
+    void end_phase(Phase phase);
+
+    // Finishes timing a sample.
+    void end_sample();
+
+    // Returns the fraction of wall time the target spent stopped since the previous call, or a negative number if less than `window` nanoseconds have passed.
+    double window_stopped_fraction(uint64_t window);
+
+    // Prints the phase distributions, the overall stopped fraction, and `syscalls`.
+    void print_statistics(const SyscallCounts &syscalls) const;
+private:
+    static const char *phase_name(Phase phase);
+
+    uint64_t _mark;
+    uint64_t _sample_start;
+    uint64_t _sample_phase_times[PHASE_COUNT];
+    bool _sample_phase_ended[PHASE_COUNT];
+
+    Histogram _phase_times[PHASE_COUNT];
+    Histogram _sample_times;
+
+    uint64_t _start_time;
+    uint64_t _end_time;
+    uint64_t _stopped_time;
+    uint64_t _window_start;
+    uint64_t _window_stopped_time;
+};
+
+#endif /* OVERHEAD_H */
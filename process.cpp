@@ -0,0 +1,305 @@
+//
+//  process.cpp
+//  drspin
+//
+//  Created by Matt Jacobson on 6/2/22.
+//
+
+#include "process.h"
+#include "call-tree.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+bool parse_sample_filter(const char *const name, SampleFilter &filter) {
+    if (!strcmp(name, "all")) {
+        filter = SampleFilter::all;
+    } else if (!strcmp(name, "on-cpu")) {
+        filter = SampleFilter::on_cpu;
+    } else if (!strcmp(name, "off-cpu")) {
+        filter = SampleFilter::off_cpu;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+Thread::Thread(const lwpid_t lwpid)
+: lwpid(lwpid), _last_stack(StackTrie::none), _on_cpu_samples(0), _off_cpu_samples(0), _total_cpu_time(0), _last_cpu_time(UINT64_MAX), _last_round(0) { }
+
+void Thread::add_sample(const StackTrie::NodeID stack, const uint64_t timestamp, const bool on_cpu, const uint64_t cpu_time) {
+    _counts[stack]++;
+    _timeline.add(timestamp, stack, on_cpu);
+
+    if (on_cpu) {
+        _on_cpu_counts[stack]++;
+        _on_cpu_samples++;
+    } else {
+        _off_cpu_counts[stack]++;
+        _off_cpu_samples++;
+    }
+
+    if (cpu_time != 0) {
+        (on_cpu ? _on_cpu_times : _off_cpu_times)[stack] += cpu_time;
+        _total_cpu_time += cpu_time;
+    }
+
+    _last_stack = stack;
+}
+
+StackTrie::NodeID Thread::repeat_last_sample(const uint64_t timestamp, const bool on_cpu, const uint64_t cpu_time) {
+    assert(_last_stack != StackTrie::none);
+    add_sample(_last_stack, timestamp, on_cpu, cpu_time);
+
+    return _last_stack;
+}
+
+uint64_t Thread::cpu_time_since_last(const uint64_t cpu_time) {
+    // The time might seem to go backward if we couldn't read it (e.g., the thread was just created).
+    const uint64_t delta = (_last_cpu_time != UINT64_MAX && cpu_time > _last_cpu_time) ? cpu_time - _last_cpu_time : 0;
+    if (_last_cpu_time == UINT64_MAX || cpu_time > _last_cpu_time) _last_cpu_time = cpu_time;
+
+    return delta;
+}
+
+StackTrie::NodeID Thread::last_stack() const {
+    return _last_stack;
+}
+
+// Prints a sorted tree whose "addresses" are addresses or, if `collapse_offsets`, function numbers.
+static void print_call_tree(const CallTree &tree, const FunctionTable &functions, const bool collapse_offsets, FILE *const file) {
+    tree.walk([&tree, &functions, collapse_offsets, file](const CallTree::NodeID node, const unsigned int depth) {
+        const uintptr_t key = tree.address(node);
+
+        if (collapse_offsets) {
+            fprintf(file, "%*s%u  %s\n", 2 + 2 * depth, "", tree.count(node), functions.functions[key].label.c_str());
+        } else {
+            const Symbol &symbol = functions.symbol(key);
+
+            if (symbol.line != 0) {
+                const char *const slash = strrchr(symbol.file.c_str(), '/');
+                fprintf(file, "%*s%u  %s at %s:%u (%#lx)\n", 2 + 2 * depth, "", tree.count(node), symbol.description.c_str(), slash ? slash + 1 : symbol.file.c_str(), symbol.line, key);
+            } else {
+                fprintf(file, "%*s%u  %s (%#lx)\n", 2 + 2 * depth, "", tree.count(node), symbol.description.c_str(), key);
+            }
+        }
+    });
+}
+
+void Thread::print_tree(const StackTrie &stacks, const FunctionTable &functions, const ReportOptions &options, FILE *const file) const {
+    fprintf(file, "  Thread %#x: %u on-CPU and %u off-CPU samples, %.3f seconds of CPU time\n", this->lwpid, _on_cpu_samples, _off_cpu_samples, _total_cpu_time / 1e9);
+
+    CallTree tree;
+    std::vector<uintptr_t> frames;
+
+    for (const auto [stack, count] : counts(options.filter)) {
+        stacks.frames(stack, frames);
+
+        if (options.collapse_offsets) {
+            for (uintptr_t &frame : frames) frame = functions.function(frame);
+        }
+
+        tree.add(frames.data(), frames.size(), count);
+    }
+
+    tree.sort();
+    print_call_tree(tree, functions, options.collapse_offsets, file);
+
+    fprintf(file, "\n");
+}
+
+const std::unordered_map<StackTrie::NodeID, unsigned int> &Thread::counts(const SampleFilter filter) const {
+    switch (filter) {
+        case SampleFilter::all: return _counts;
+        case SampleFilter::on_cpu: return _on_cpu_counts;
+        case SampleFilter::off_cpu: return _off_cpu_counts;
+    }
+
+    abort();
+}
+
+uint64_t Thread::cpu_time(const StackTrie::NodeID stack, const SampleFilter filter) const {
+    const auto lookup = [stack](const std::unordered_map<StackTrie::NodeID, uint64_t> &times) -> uint64_t {
+        const auto entry = times.find(stack);
+        return (entry != times.end()) ? entry->second : 0;
+    };
+
+    switch (filter) {
+        case SampleFilter::all: return lookup(_on_cpu_times) + lookup(_off_cpu_times);
+        case SampleFilter::on_cpu: return lookup(_on_cpu_times);
+        case SampleFilter::off_cpu: return lookup(_off_cpu_times);
+    }
+
+    abort();
+}
+
+const Timeline &Thread::timeline() const {
+    return _timeline;
+}
+
+Process::Process(const pid_t pid, const std::string name)
+: _pid(pid), _name(name), _round(0) { }
+
+pid_t Process::pid() const {
+    return _pid;
+}
+
+const char *Process::name() const {
+    return _name.c_str();
+}
+
+void Process::begin_round() {
+    _round++;
+}
+
+Thread &Process::thread(const lwpid_t lwpid) {
+    const auto entry = _thread_index.find(lwpid);
+
+    if (entry != _thread_index.end() && entry->second->_last_round + 1 >= _round) {
+        Thread &thread = *entry->second;
+        thread._last_round = _round;
+
+        return thread;
+    }
+
+    Thread &thread = _threads.emplace_back(lwpid);
+    thread._last_round = _round;
+    _thread_index[lwpid] = &thread;
+
+    return thread;
+}
+
+const std::deque<Thread> &Process::threads() const {
+    return _threads;
+}
+
+StackTrie::NodeID Process::add_sample(Thread &thread, const std::vector<uintptr_t> &stack, const uint64_t timestamp, const bool on_cpu, const uint64_t cpu_time) {
+    const StackTrie::NodeID node = _stacks.intern(stack);
+    thread.add_sample(node, timestamp, on_cpu, cpu_time);
+
+    return node;
+}
+
+void Process::add_sample(const lwpid_t lwpid, const StackTrie::NodeID stack, const uint64_t timestamp, const bool on_cpu, const uint64_t cpu_time) {
+    thread(lwpid).add_sample(stack, timestamp, on_cpu, cpu_time);
+}
+
+StackTrie &Process::stacks() {
+    return _stacks;
+}
+
+const StackTrie &Process::stacks() const {
+    return _stacks;
+}
+
+void Process::print_title(const ReportOptions &options, FILE *const file) const {
+    const char *const title = (options.filter == SampleFilter::on_cpu) ? " (on-CPU samples only)" : (options.filter == SampleFilter::off_cpu) ? " (off-CPU samples only)" : "";
+    fprintf(file, "Process: %s [%d]%s\n\n", name(), _pid, title);
+}
+
+void Process::print_tree(Symbolicator &symbolicator, const ReportOptions &options, FILE *const file) const {
+    // Symbolicate every distinct address once, up front, rather than as each tree node is printed.
+    const FunctionTable functions(_stacks, symbolicator);
+
+    print_title(options, file);
+
+    for (const Thread &thread : _threads) {
+        // A thread with no samples of the selected kind would just be a header.
+        if (!thread.counts(options.filter).empty()) {
+            thread.print_tree(_stacks, functions, options, file);
+        }
+    }
+}
+
+void Process::print_functions(Symbolicator &symbolicator, const ReportOptions &options, const bool bottom_up, FILE *const file) const {
+    const FunctionTable functions(_stacks, symbolicator);
+
+    struct Totals {
+        unsigned int self;
+        unsigned int total;
+    };
+
+    std::vector<Totals> totals(functions.functions.size(), { .self = 0, .total = 0 });
+    uint64_t samples = 0;
+
+    // A recursive function counts once per sample toward its total, so remember which stack last counted it.
+    std::vector<size_t> last_counted(functions.functions.size(), SIZE_MAX);
+    size_t stack_index = 0;
+
+    CallTree tree;
+    std::vector<uintptr_t> frames;
+    std::vector<uintptr_t> keys;
+
+    for (const Thread &thread : _threads) {
+        for (const auto [stack, count] : thread.counts(options.filter)) {
+            _stacks.frames(stack, frames);
+            samples += count;
+            stack_index++;
+
+            if (frames.empty()) continue;
+
+            totals[functions.function(frames.back())].self += count;
+
+            for (const uintptr_t frame : frames) {
+                const size_t function = functions.function(frame);
+
+                if (last_counted[function] != stack_index) {
+                    last_counted[function] = stack_index;
+                    totals[function].total += count;
+                }
+            }
+
+            if (bottom_up) {
+                // Frames are outermost first, so reverse them.
+                keys.clear();
+                for (auto iter = frames.rbegin(); iter != frames.rend(); iter++) {
+                    keys.push_back(options.collapse_offsets ? functions.function(*iter) : *iter);
+                }
+
+                tree.add(keys.data(), keys.size(), count);
+            }
+        }
+    }
+
+    print_title(options, file);
+
+    std::vector<size_t> order;
+    for (size_t function = 0; function < totals.size(); function++) {
+        if (totals[function].total != 0) order.push_back(function);
+    }
+
+    std::sort(order.begin(), order.end(), [&totals](const size_t a, const size_t b) {
+        if (totals[a].self != totals[b].self) return totals[a].self > totals[b].self;
+        if (totals[a].total != totals[b].total) return totals[a].total > totals[b].total;
+        return a < b;
+    });
+
+    if (options.top_count != 0 && order.size() > options.top_count) {
+        order.resize(options.top_count);
+    }
+
+    const double percent = samples ? 100.0 / samples : 0;
+    fprintf(file, "  Top functions by self samples, of %llu samples in all threads:\n", (unsigned long long)samples);
+    fprintf(file, "  %14s  %14s  %s\n", "Self", "Total", "Function");
+
+    for (const size_t function : order) {
+        fprintf(file, "  %7u %5.1f%%  %7u %5.1f%%  %s\n", totals[function].self, totals[function].self * percent, totals[function].total, totals[function].total * percent, functions.functions[function].label.c_str());
+    }
+
+    fprintf(file, "\n");
+
+    if (bottom_up) {
+        fprintf(file, "  Bottom-up tree, innermost frames first, with their callers beneath them:\n");
+
+        tree.sort();
+        print_call_tree(tree, functions, options.collapse_offsets, file);
+
+        fprintf(file, "\n");
+    }
+}
@@ -0,0 +1,133 @@
+//
+//  process.h
+//  drspin
+//
+//  Created by Matt Jacobson on 6/2/22.
+//
+
+#include "function-table.h"
+#include "sampler.h"
+#include "stack-trie.h"
+#include "timeline.h"
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+// Which samples a report includes, by whether the thread was on a CPU when it was sampled (see ThreadState).  On-CPU samples show where CPU time goes; off-CPU samples show where threads wait (e.g., on locks or IO).
+enum class SampleFilter {
+    all,
+    on_cpu,
+    off_cpu,
+};
+
+// Parses a --state argument.  Returns false if it isn't recognized.
+bool parse_sample_filter(const char *name, SampleFilter &filter);
+
+// What a report includes and how it groups frames.
+struct ReportOptions {
+    SampleFilter filter = SampleFilter::all;
+
+    // Whether trees merge the frames of a function at different offsets into one node (e.g., "main (in drspin)" rather than "main + 16 (in drspin)" and "main + 42 (in drspin)").
+    bool collapse_offsets = false;
+
+    // How many functions Process::print_functions() lists, or 0 for all of them.
+    size_t top_count = 30;
+};
+
+struct Thread {
+    const lwpid_t lwpid;
+
+    Thread(lwpid_t lwpid);
+
+    // Records a sample, taken at `timestamp` (monotonic nanoseconds) while the thread was on or off a CPU, after it had used `cpu_time` nanoseconds of CPU time since its previous sample.
+    void add_sample(StackTrie::NodeID stack, uint64_t timestamp, bool on_cpu, uint64_t cpu_time);
+
+    // Records another sample with the same stack as the last one, and returns that stack.
+    StackTrie::NodeID repeat_last_sample(uint64_t timestamp, bool on_cpu, uint64_t cpu_time);
+
+    // The stack of the last sample, or StackTrie::none if there hasn't been one.
+    StackTrie::NodeID last_stack() const;
+
+    // Given the thread's total CPU time, returns how much it has used since the last call (or 0 the first time).
+    uint64_t cpu_time_since_last(uint64_t cpu_time);
+
+    void print_tree(const StackTrie &stacks, const FunctionTable &functions, const ReportOptions &options, FILE *file) const;
+
+    // The number of samples of each distinct stack, counting only the samples `filter` selects.
+    const std::unordered_map<StackTrie::NodeID, unsigned int> &counts(SampleFilter filter) const;
+
+    // The CPU time charged to a stack: for each sample of the stack that passes `filter`, the CPU time the thread used since its previous sample.
+    uint64_t cpu_time(StackTrie::NodeID stack, SampleFilter filter) const;
+
+    // Every sample, in order.
+    const Timeline &timeline() const;
+private:
+    std::unordered_map<StackTrie::NodeID, unsigned int> _counts;
+    std::unordered_map<StackTrie::NodeID, unsigned int> _on_cpu_counts;
+    std::unordered_map<StackTrie::NodeID, unsigned int> _off_cpu_counts;
+    std::unordered_map<StackTrie::NodeID, uint64_t> _on_cpu_times;
+    std::unordered_map<StackTrie::NodeID, uint64_t> _off_cpu_times;
+    Timeline _timeline;
+    StackTrie::NodeID _last_stack;
+    unsigned int _on_cpu_samples;
+    unsigned int _off_cpu_samples;
+    uint64_t _total_cpu_time; // charged to samples
+    uint64_t _last_cpu_time; // as of the last cpu_time_since_last()
+
+    // The last round (see Process::begin_round()) in which this thread was looked up.
+    uint64_t _last_round;
+    friend struct Process;
+};
+
+struct Process : private DeleteImplicit {
+    Process(pid_t pid, std::string name);
+    pid_t pid() const;
+    const char *name() const;
+
+    // Starts a round of samples, in which every live thread is sampled once.  A thread ID that skips a round belonged to a thread that exited, so if it turns up again, it's a new thread.
+    void begin_round();
+
+    Thread &thread(lwpid_t lwpid);
+    const std::deque<Thread> &threads() const;
+
+    // Records a sample of the given thread (see Thread::add_sample()), and returns its interned stack.  The stack is given innermost frame first.
+    StackTrie::NodeID add_sample(Thread &thread, const std::vector<uintptr_t> &stack, uint64_t timestamp, bool on_cpu, uint64_t cpu_time);
+
+    // Records a sample of an already-interned stack.
+    void add_sample(lwpid_t lwpid, StackTrie::NodeID stack, uint64_t timestamp, bool on_cpu, uint64_t cpu_time);
+
+    StackTrie &stacks();
+    const StackTrie &stacks() const;
+
+    // Prints each thread's call tree, outermost frames first.
+    void print_tree(Symbolicator &symbolicator, const ReportOptions &options, FILE *file) const;
+
+    // Prints the samples of all threads merged and grouped by function: a table of the functions with the most self samples (as the innermost frame), with their total samples (anywhere on the stack), followed, if `bottom_up`, by the inverted call tree, whose roots are the innermost frames and whose children are their callers.  Both come from one pass over the distinct stacks.
+    void print_functions(Symbolicator &symbolicator, const ReportOptions &options, bool bottom_up, FILE *file) const;
+private:
+    void print_title(const ReportOptions &options, FILE *file) const;
+
+    pid_t _pid;
+    std::string _name;
+    uint64_t _round;
+
+    // Every thread ever seen, in order of appearance.  A deque, so that references stay valid as threads are added.
+    std::deque<Thread> _threads;
+
+    // The current thread with each ID.
+    std::unordered_map<lwpid_t, Thread *> _thread_index;
+
+    // Shared by all threads, since they tend to have many stacks (or at least prefixes) in common.
+    StackTrie _stacks;
+};
+
+#endif /* PROCESS_H */
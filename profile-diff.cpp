@@ -0,0 +1,210 @@
+//
+//  profile-diff.cpp
+//  drspin
+//
+
+#include "profile-diff.h"
+#include "exporters.h"
+#include "function-table.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+ProfileDiff::ProfileDiff()
+: _samples{0, 0} { }
+
+size_t ProfileDiff::PathHash::operator()(const Path &path) const {
+    // FNV-1a over the name IDs.
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (const NameID name : path) {
+        hash = (hash ^ name) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+ProfileDiff::NameID ProfileDiff::intern(const std::string &name) {
+    const auto [entry, inserted] = _name_ids.try_emplace(name, (NameID)_names.size());
+
+    if (inserted) {
+        _names.push_back(name);
+        _functions.push_back({ .self = {0, 0}, .total = {0, 0} });
+    }
+
+    return entry->second;
+}
+
+void ProfileDiff::add(const Side side, const Process &process, Symbolicator &symbolicator, const SampleFilter filter) {
+    const FunctionTable table(process.stacks(), symbolicator);
+
+    // Match functions by name alone, as flame graphs do, so that a library whose name changed (e.g., with its version) still lines up.
+    std::vector<NameID> names;
+    names.reserve(table.functions.size());
+
+    for (const FunctionTable::Function &function : table.functions) {
+        names.push_back(intern(function.name));
+    }
+
+    // A recursive function counts once per sample toward its total, so remember which stack last counted it.
+    std::vector<size_t> last_counted(_names.size(), SIZE_MAX);
+    size_t stack_index = 0;
+
+    std::vector<uintptr_t> frames;
+    Path path;
+
+    for (const Thread &thread : process.threads()) {
+        for (const auto [stack, count] : thread.counts(filter)) {
+            process.stacks().frames(stack, frames);
+            _samples[side] += count;
+            stack_index++;
+
+            if (frames.empty()) continue;
+
+            path.clear();
+            for (const uintptr_t address : frames) {
+                path.push_back(names[table.function(address)]);
+            }
+
+            _paths[path][side] += count;
+            _functions[path.back()].self[side] += count;
+
+            for (const NameID name : path) {
+                if (last_counted[name] != stack_index) {
+                    last_counted[name] = stack_index;
+                    _functions[name].total[side] += count;
+                }
+            }
+        }
+    }
+}
+
+double ProfileDiff::share(const Side side, const uint64_t count) const {
+    return _samples[side] ? 100.0 * count / _samples[side] : 0;
+}
+
+std::string ProfileDiff::path_string(const Path &path) const {
+    std::string string;
+
+    for (const NameID name : path) {
+        if (!string.empty()) string += ';';
+        string += _names[name];
+    }
+
+    return string;
+}
+
+void ProfileDiff::print(const size_t top_count, FILE *const file) const {
+    fprintf(file, "Before: %llu samples.  After: %llu samples.  Shares are percentages of each profile's samples.\n\n", (unsigned long long)_samples[before], (unsigned long long)_samples[after]);
+
+    // Functions, by the larger of the changes in their self and total shares.
+    struct FunctionChange {
+        NameID name;
+        double self[2];
+        double total[2];
+        double magnitude;
+    };
+
+    std::vector<FunctionChange> functions;
+
+    for (NameID name = 0; name < _functions.size(); name++) {
+        const FunctionCounts &counts = _functions[name];
+        FunctionChange &change = functions.emplace_back();
+        change.name = name;
+
+        for (const Side side : { before, after }) {
+            change.self[side] = share(side, counts.self[side]);
+            change.total[side] = share(side, counts.total[side]);
+        }
+
+        change.magnitude = std::max(fabs(change.self[after] - change.self[before]), fabs(change.total[after] - change.total[before]));
+    }
+
+    std::sort(functions.begin(), functions.end(), [](const FunctionChange &a, const FunctionChange &b) {
+        if (a.magnitude != b.magnitude) return a.magnitude > b.magnitude;
+        return a.name < b.name;
+    });
+
+    if (top_count != 0 && functions.size() > top_count) {
+        functions.resize(top_count);
+    }
+
+    fprintf(file, "  Functions, by change in share:\n");
+    fprintf(file, "  %-23s   %s\n", "Self", "Total");
+    fprintf(file, "  %7s %7s %7s   %7s %7s %7s  %s\n", "before", "after", "change", "before", "after", "change", "Function");
+
+    for (const FunctionChange &change : functions) {
+        fprintf(file, "  %6.2f%% %6.2f%% %+7.2f   %6.2f%% %6.2f%% %+7.2f  %s\n", change.self[before], change.self[after], change.self[after] - change.self[before], change.total[before], change.total[after], change.total[after] - change.total[before], _names[change.name].c_str());
+    }
+
+    fprintf(file, "\n");
+
+    // Stacks, by the change in their share.
+    std::vector<std::pair<const Path *, double>> paths;
+
+    for (const auto &[path, counts] : _paths) {
+        paths.emplace_back(&path, share(after, counts[after]) - share(before, counts[before]));
+    }
+
+    std::sort(paths.begin(), paths.end(), [](const std::pair<const Path *, double> &a, const std::pair<const Path *, double> &b) {
+        if (fabs(a.second) != fabs(b.second)) return fabs(a.second) > fabs(b.second);
+        return *a.first < *b.first;
+    });
+
+    if (top_count != 0 && paths.size() > top_count) {
+        paths.resize(top_count);
+    }
+
+    fprintf(file, "  Stacks, by change in share:\n");
+    fprintf(file, "  %7s %7s %7s  %s\n", "before", "after", "change", "Stack");
+
+    for (const auto &[path, change] : paths) {
+        const std::array<uint64_t, 2> &counts = _paths.at(*path);
+        fprintf(file, "  %6.2f%% %6.2f%% %+7.2f  %s\n", share(before, counts[before]), share(after, counts[after]), change, path_string(*path).c_str());
+    }
+
+    fprintf(file, "\n");
+}
+
+void ProfileDiff::export_collapsed(FILE *const file) const {
+    OutputBuffer out(file);
+
+    // Semicolons separate frames, so they can't appear in names.
+    std::vector<std::string> names = _names;
+
+    for (std::string &name : names) {
+        std::replace(name.begin(), name.end(), ';', ':');
+    }
+
+    // Sort the stacks by name, as flamegraph.pl expects.
+    std::vector<std::pair<std::string, const std::array<uint64_t, 2> *>> lines;
+    lines.reserve(_paths.size());
+
+    for (const auto &[path, counts] : _paths) {
+        std::string line;
+
+        for (const NameID name : path) {
+            if (!line.empty()) line += ';';
+            line += names[name];
+        }
+
+        lines.emplace_back(std::move(line), &counts);
+    }
+
+    std::sort(lines.begin(), lines.end());
+
+    const double scale = _samples[before] ? (double)_samples[after] / _samples[before] : 0;
+
+    for (const auto &[line, counts] : lines) {
+        out.append(line);
+        out.append(' ');
+        out.append_decimal((uint64_t)llround((*counts)[before] * scale));
+        out.append(' ');
+        out.append_decimal((*counts)[after]);
+        out.append('\n');
+    }
+}
@@ -0,0 +1,66 @@
+//
+//  profile-diff.h
+//  drspin
+//
+
+#include "process.h"
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef PROFILE_DIFF_H
+#define PROFILE_DIFF_H
+
+// Compares two profiles (e.g., before and after a change) by symbolic stack: frames are matched by function name rather than by address, so the profiles can come from different runs (with libraries loaded elsewhere) or even different builds.  Threads are merged, since they rarely correspond from run to run.
+//
+// Each profile's counts are normalized by its own number of samples, so the profiles needn't be the same length or rate; changes are given in percentage points.
+struct ProfileDiff : private DeleteImplicit {
+    enum Side {
+        before = 0,
+        after = 1,
+    };
+
+    ProfileDiff();
+
+    // Adds the samples in `process` that `filter` selects to one side, symbolicating every address (in one batch) first.  Each side should be added once.
+    void add(Side side, const Process &process, Symbolicator &symbolicator, SampleFilter filter);
+
+    // Prints the `top_count` functions (or all of them, if 0) whose self and total shares changed the most, and likewise for whole stacks.
+    void print(size_t top_count, FILE *file) const;
+
+    // Writes each stack as semicolon-separated function names (outermost first) followed by its counts in the two profiles, the format flamegraph.pl reads to draw a differential flame graph.  The "before" counts are scaled to the "after" profile's number of samples.
+    void export_collapsed(FILE *file) const;
+private:
+    using NameID = uint32_t;
+    using Path = std::vector<NameID>;
+
+    struct PathHash {
+        size_t operator()(const Path &path) const;
+    };
+
+    struct FunctionCounts {
+        uint64_t self[2];
+        uint64_t total[2];
+    };
+
+    NameID intern(const std::string &name);
+    double share(Side side, uint64_t count) const;
+    std::string path_string(const Path &path) const;
+
+    uint64_t _samples[2];
+    std::vector<std::string> _names;
+    std::unordered_map<std::string, NameID> _name_ids;
+
+    // Indexed by NameID.
+    std::vector<FunctionCounts> _functions;
+
+    // Each distinct stack's count in the two profiles.
+    std::unordered_map<Path, std::array<uint64_t, 2>, PathHash> _paths;
+};
+
+#endif /* PROFILE_DIFF_H */
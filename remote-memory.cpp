@@ -0,0 +1,107 @@
+//
+//  remote-memory.cpp
+//  drspin
+//
+
+#include "remote-memory.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+RemoteMemory::RemoteMemory(Sampler &sampler)
+: _sampler(sampler), _page_size(getpagesize()) { }
+
+const char *RemoteMemory::page(const uintptr_t page_address, const uintptr_t last_page_address) {
+    const auto entry = _pages.find(page_address);
+    if (entry != _pages.end()) return entry->second.get();
+
+    // Fetch this page and any missing pages after it (up to the last page needed) in one read.
+    size_t page_count = 1;
+    while (page_address + page_count * _page_size <= last_page_address && _pages.find(page_address + page_count * _page_size) == _pages.end()) {
+        page_count++;
+    }
+
+    std::vector<char> buffer(page_count * _page_size);
+    const size_t count = _sampler.read(page_address, buffer.data(), buffer.size());
+
+    // A short read stops at the first unreadable page.  Cache that page as unreadable, but not the ones after it, which might well be readable.
+    for (size_t i = 0; i < page_count; i++) {
+        if ((i + 1) * _page_size <= count) {
+            std::unique_ptr<char[]> contents = std::make_unique<char[]>(_page_size);
+            memcpy(contents.get(), &buffer[i * _page_size], _page_size);
+            _pages.emplace(page_address + i * _page_size, std::move(contents));
+        } else {
+            if (i * _page_size == count) {
+                _pages.emplace(page_address + i * _page_size, nullptr);
+            }
+
+            break;
+        }
+    }
+
+    const auto new_entry = _pages.find(page_address);
+    return new_entry != _pages.end() ? new_entry->second.get() : nullptr;
+}
+
+bool RemoteMemory::read(const uintptr_t address, void *const buffer, const size_t size) {
+    if (size == 0) return true;
+
+    const uintptr_t last_page_address = (address + size - 1) / _page_size * _page_size;
+    size_t done = 0;
+
+    while (done < size) {
+        const uintptr_t cur_address = address + done;
+        const uintptr_t page_address = cur_address / _page_size * _page_size;
+        const char *const contents = page(page_address, last_page_address);
+        if (contents == nullptr) return false;
+
+        const size_t offset = cur_address - page_address;
+        const size_t chunk_size = std::min(size - done, _page_size - offset);
+        memcpy((char *)buffer + done, contents + offset, chunk_size);
+        done += chunk_size;
+    }
+
+    return true;
+}
+
+std::string RemoteMemory::read_string(const uintptr_t address) {
+    std::string result;
+    uintptr_t cur_address = address;
+
+    for (;;) {
+        const uintptr_t page_address = cur_address / _page_size * _page_size;
+        const char *const contents = page(page_address, page_address);
+        assert(contents != nullptr);
+
+        const size_t offset = cur_address - page_address;
+        const size_t length = strnlen(contents + offset, _page_size - offset);
+        result.append(contents + offset, length);
+
+        if (offset + length < _page_size) break;
+        cur_address = page_address + _page_size;
+    }
+
+    return result;
+}
+
+void RemoteMemory::prefetch(const uintptr_t address, const size_t size) {
+    if (size == 0) return;
+
+    const uintptr_t last_page_address = (address + size - 1) / _page_size * _page_size;
+
+    for (uintptr_t page_address = address / _page_size * _page_size; page_address <= last_page_address; page_address += _page_size) {
+        if (page(page_address, last_page_address) == nullptr) break;
+    }
+}
+
+size_t RemoteMemory::read_direct(const uintptr_t address, void *const buffer, const size_t size) {
+    return _sampler.read(address, buffer, size);
+}
+
+void RemoteMemory::invalidate() {
+    _pages.clear();
+}
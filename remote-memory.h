@@ -0,0 +1,55 @@
+//
+//  remote-memory.h
+//  drspin
+//
+
+#include "sampler.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#ifndef REMOTE_MEMORY_H
+#define REMOTE_MEMORY_H
+
+// Reads the target's memory through a read-through cache of whole pages, so that walking many small objects (dynamic linker structures, array elements, strings, out-of-window stack frames) costs a syscall per page rather than one per object.  Contiguous missing pages are fetched in one transfer.
+//
+// The cache is only valid while the target is stopped; call invalidate() whenever it has run.
+struct RemoteMemory {
+    RemoteMemory(Sampler &sampler);
+
+    // Reads exactly `size` bytes at `address` through the cache.  Returns false if any of them couldn't be read.
+    bool read(uintptr_t address, void *buffer, size_t size);
+
+    template<typename T>
+    T read(const uintptr_t address) {
+        T data;
+        const bool ok = read(address, &data, sizeof (T));
+        assert(ok);
+
+        return data;
+    }
+
+    std::string read_string(uintptr_t address);
+
+    // Brings the pages covering a range into the cache, in one transfer if none of them are cached.
+    void prefetch(uintptr_t address, size_t size);
+
+    // Reads up to `size` bytes at `address`, bypassing the cache, for large one-off reads like stack windows.  Returns the number of bytes read.
+    size_t read_direct(uintptr_t address, void *buffer, size_t size);
+
+    void invalidate();
+private:
+    // Returns the cached contents of the page at `page_address`, or nullptr if it can't be read.  Missing pages from there up to `last_page_address` are fetched together.
+    const char *page(uintptr_t page_address, uintptr_t last_page_address);
+
+    Sampler &_sampler;
+    const size_t _page_size;
+
+    // Pages that couldn't be read are cached as nullptr.
+    std::unordered_map<uintptr_t, std::unique_ptr<char[]>> _pages;
+};
+
+#endif /* REMOTE_MEMORY_H */
@@ -0,0 +1,117 @@
+//
+//  sampler.h
+//  drspin
+//
+
+#include "util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#if defined(__linux__)
+typedef pid_t lwpid_t;
+#endif /* __linux__ */
+
+struct Registers {
+    uintptr_t pc;
+    uintptr_t fp;
+    uintptr_t sp;
+    uintptr_t lr; // the link register, on architectures that have one (so the DWARF unwinder can find a leaf function's return address); otherwise 0
+};
+
+// What a thread was doing just before the target was stopped to sample it.
+struct ThreadState {
+    // Whether it was running or waiting to run, as opposed to sleeping or blocked (e.g., on a lock or on IO).
+    bool on_cpu;
+
+    // The CPU time (user and system) it had used so far, in nanoseconds.
+    uint64_t cpu_time;
+};
+
+// Counts the syscalls a Sampler makes, by name, for the overhead report.
+struct SyscallCounts {
+    void add(const char *const name) {
+        for (auto &entry : _counts) {
+            if (!strcmp(entry.first, name)) {
+                entry.second++;
+                return;
+            }
+        }
+
+        _counts.emplace_back(name, 1);
+    }
+
+    uint64_t total() const {
+        uint64_t total = 0;
+        for (const auto &entry : _counts) total += entry.second;
+        return total;
+    }
+
+    // Prints each count, and its average over `samples` samples.
+    void print(const uint64_t samples) const {
+        for (const auto &entry : _counts) {
+            printf("    %-28s %10llu  (%.1f per sample)\n", entry.first, (unsigned long long)entry.second, samples > 0 ? (double)entry.second / samples : 0);
+        }
+    }
+private:
+    std::vector<std::pair<const char *, uint64_t>> _counts;
+};
+
+// A Sampler is the platform-specific half of drspin: it stops and resumes the target and gives access to its threads' registers and memory.
+struct Sampler : private DeleteImplicit {
+    virtual std::string process_name() = 0;
+
+    // Attaches to the target and waits for it to stop.
+    virtual void attach() = 0;
+
+    // Stops the (running) target and waits for all of its threads to stop.
+    void stop() {
+        read_thread_states();
+        request_stop();
+        wait_for_stop();
+    }
+
+    // Reads every thread's ThreadState.  This has to happen while the target is running, since once it's stopped, every thread is just "stopped"; stop() and attach() do it first.
+    virtual void read_thread_states() = 0;
+
+    // A thread's state as of the last read_thread_states().  A thread created since then is assumed to be running.
+    ThreadState thread_state(const lwpid_t lwpid) const {
+        const auto entry = _thread_states.find(lwpid);
+        return (entry != _thread_states.end()) ? entry->second : ThreadState { .on_cpu = true, .cpu_time = 0 };
+    }
+
+    // The two halves of stop(), for callers that time them separately.
+    virtual void request_stop() = 0;
+    virtual void wait_for_stop() = 0;
+
+    // Resumes the (stopped) target.
+    virtual void resume() = 0;
+
+    // Detaches from the (stopped) target, leaving it running.
+    virtual void detach() = 0;
+
+    // The remaining methods require the target to be stopped.
+    virtual std::vector<lwpid_t> threads() = 0;
+    virtual Registers registers(lwpid_t lwpid) = 0;
+
+    // Reads up to `size` bytes at `address` in the target.  Returns the number of bytes read, which is short if a fault occurred.
+    virtual size_t read(uintptr_t address, void *buffer, size_t size) = 0;
+
+    // The syscalls made so far.
+    const SyscallCounts &syscalls() const { return _syscalls; }
+
+    virtual ~Sampler() = default;
+protected:
+    SyscallCounts _syscalls;
+    std::unordered_map<lwpid_t, ThreadState> _thread_states;
+};
+
+#endif /* SAMPLER_H */
@@ -0,0 +1,208 @@
+//
+//  scheduler.cpp
+//  drspin
+//
+
+#include "scheduler.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__)
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/timerfd.h>
+#endif
+
+const uint64_t nanoseconds_per_second = 1000000000;
+
+static uint64_t timespec_nanoseconds(const struct timespec &ts) {
+    return (uint64_t)ts.tv_sec * nanoseconds_per_second + ts.tv_nsec;
+}
+
+static double milliseconds(const uint64_t nanoseconds) {
+    return nanoseconds / 1e6;
+}
+
+SampleScheduler::SampleScheduler(const pid_t pid, const double rate, const SampleClock clock, const double duration)
+: _pid(pid), _requested_rate(rate), _clock(clock), _rate(rate), _interval(std::max((uint64_t)1, (uint64_t)(nanoseconds_per_second / rate))), _duration(duration * nanoseconds_per_second), _cpu_clock(), _fd(-1), _start_time(0), _last_sample_time(0), _last_sample_cpu_time(0), _end_time(0), _samples(0), _missed_ticks(0), _idle_ticks(0), _rate_changes(0) {
+    if (_clock == SampleClock::cpu) {
+        const int rv = clock_getcpuclockid(_pid, &_cpu_clock);
+
+        if (rv) {
+            fprintf(stderr, "drspin: can't read CPU clock of process %d: %s\n", _pid, strerror(rv));
+            exit(1);
+        }
+    }
+}
+
+SampleScheduler::~SampleScheduler() {
+    if (_fd != -1) {
+        close(_fd);
+    }
+}
+
+void SampleScheduler::arm_timer() {
+    int rv;
+
+#if defined(__FreeBSD__)
+    // Periodic kqueue timers are rearmed relative to their previous deadline, not to when they were delivered, and report the number of expirations since the last delivery.  Adding the timer again replaces it.
+    struct kevent change;
+    EV_SET(&change, 0, EVFILT_TIMER, EV_ADD, NOTE_NSECONDS, _interval, NULL);
+
+    rv = kevent(_fd, &change, 1, NULL, 0, NULL);
+    assert(rv != -1);
+#elif defined(__linux__)
+    const struct timespec interval = {
+        .tv_sec = (time_t)(_interval / nanoseconds_per_second),
+        .tv_nsec = (long)(_interval % nanoseconds_per_second),
+    };
+
+    const struct itimerspec spec = {
+        .it_interval = interval,
+        .it_value = interval,
+    };
+
+    rv = timerfd_settime(_fd, 0, &spec, NULL);
+    assert(!rv);
+#endif
+}
+
+void SampleScheduler::start() {
+#if defined(__FreeBSD__)
+    _fd = kqueue();
+#elif defined(__linux__)
+    _fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif
+    assert(_fd != -1);
+
+    arm_timer();
+
+    _start_time = monotonic_time();
+    _last_sample_time = _start_time;
+    _end_time = _start_time;
+    _samples = 1;
+
+    if (_clock == SampleClock::cpu) {
+        _last_sample_cpu_time = cpu_time();
+    }
+}
+
+void SampleScheduler::set_rate(const double rate) {
+    _rate = rate;
+    _interval = std::max((uint64_t)1, (uint64_t)(nanoseconds_per_second / rate));
+    _rate_changes++;
+
+    arm_timer();
+}
+
+uint64_t SampleScheduler::wait_tick() {
+#if defined(__FreeBSD__)
+    struct kevent event;
+
+    for (;;) {
+        const int rv = kevent(_fd, NULL, 0, &event, 1, NULL);
+
+        if (rv == 1) {
+            return event.data;
+        }
+
+        assert(rv == -1 && errno == EINTR);
+    }
+#elif defined(__linux__)
+    uint64_t ticks;
+
+    for (;;) {
+        const ssize_t rv = read(_fd, &ticks, sizeof (ticks));
+
+        if (rv == sizeof (ticks)) {
+            return ticks;
+        }
+
+        assert(rv == -1 && errno == EINTR);
+    }
+#endif
+}
+
+uint64_t SampleScheduler::cpu_time() const {
+    struct timespec ts;
+    const int rv = clock_gettime(_cpu_clock, &ts);
+
+    // The target may have exited.
+    if (rv) return _last_sample_cpu_time;
+
+    return timespec_nanoseconds(ts);
+}
+
+bool SampleScheduler::wait(const bool &stop) {
+    for (;;) {
+        const uint64_t ticks = wait_tick();
+        _missed_ticks += ticks - 1;
+
+        const uint64_t now = monotonic_time();
+        _end_time = now;
+
+        // With the CPU clock, an idle target can keep us here for the whole duration.
+        if (now - _start_time >= _duration || stop) {
+            return false;
+        }
+
+        if (_clock == SampleClock::cpu) {
+            const uint64_t cpu_now = cpu_time();
+
+            if (cpu_now - _last_sample_cpu_time < _interval) {
+                _idle_ticks++;
+                continue;
+            }
+
+            _last_sample_cpu_time = cpu_now;
+        }
+
+        _intervals.add(now - _last_sample_time);
+        _last_sample_time = now;
+        _samples++;
+
+        return true;
+    }
+}
+
+uint64_t SampleScheduler::samples() const {
+    return _samples;
+}
+
+uint64_t SampleScheduler::missed_ticks() const {
+    return _missed_ticks;
+}
+
+double SampleScheduler::achieved_rate() const {
+    const double elapsed = (double)(_end_time - _start_time) / nanoseconds_per_second;
+    return elapsed > 0 ? _samples / elapsed : 0;
+}
+
+void SampleScheduler::print_statistics() const {
+    const double elapsed = (double)(_end_time - _start_time) / nanoseconds_per_second;
+
+    printf("  Requested rate: %g Hz (%s clock)\n", _requested_rate, _clock == SampleClock::wall ? "wall" : "CPU");
+
+    if (_rate_changes > 0) {
+        printf("  Adjusted rate:  %.1f Hz (adjusted %llu times by --max-overhead)\n", _rate, (unsigned long long)_rate_changes);
+    }
+
+    printf("  Achieved rate:  %.1f Hz (%llu samples in %.3f seconds)\n", achieved_rate(), (unsigned long long)_samples, elapsed);
+    printf("  Missed ticks:   %llu\n", (unsigned long long)_missed_ticks);
+
+    if (_clock == SampleClock::cpu) {
+        printf("  Idle ticks:     %llu\n", (unsigned long long)_idle_ticks);
+    }
+
+    if (_intervals.count() > 0) {
+        printf("  Interval (ms):  min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+            milliseconds(_intervals.min()), milliseconds(_intervals.percentile(50)), milliseconds(_intervals.percentile(90)),
+            milliseconds(_intervals.percentile(99)), milliseconds(_intervals.max()));
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,73 @@
+//
+//  scheduler.h
+//  drspin
+//
+
+#include "histogram.h"
+#include "util.h"
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+enum class SampleClock {
+    // Sample every interval of wall-clock time.
+    wall,
+
+    // Sample every interval of CPU time consumed by the target (summed over its threads).  Ticks still come at most once per wall-clock interval, so an idle target isn't sampled at all and a busy multithreaded one is sampled no faster than in wall mode.
+    cpu,
+};
+
+// Paces sampling off a periodic timer with absolute deadlines (kqueue EVFILT_TIMER on FreeBSD, timerfd on Linux), so that the time spent stopping and unwinding the target doesn't stretch the interval between samples.  Keeps statistics on how well it kept up.
+struct SampleScheduler : private DeleteImplicit {
+    SampleScheduler(pid_t pid, double rate, SampleClock clock, double duration);
+    ~SampleScheduler();
+
+    // Starts the timer and the duration.  Call just before taking the first sample.
+    void start();
+
+    double rate() const { return _rate; }
+
+    // Changes the rate, keeping the duration.
+    void set_rate(double rate);
+
+    // Blocks until the next sample is due.  Returns false instead if the duration has elapsed or `stop` has been set (e.g., by a signal handler), which is checked at every tick, even ones that don't sample.
+    bool wait(const bool &stop);
+
+    uint64_t samples() const;
+    uint64_t missed_ticks() const;
+
+    // Samples per second of wall-clock time so far.
+    double achieved_rate() const;
+
+    // Prints the requested and achieved rates, missed ticks, and the distribution of intervals between samples.
+    void print_statistics() const;
+private:
+    // Blocks until the timer fires.  Returns the number of ticks since it last fired, which is more than 1 if we fell behind.
+    uint64_t wait_tick();
+    void arm_timer();
+    uint64_t cpu_time() const;
+
+    const pid_t _pid;
+    const double _requested_rate;
+    const SampleClock _clock;
+    double _rate;
+    uint64_t _interval;
+    const uint64_t _duration;
+    clockid_t _cpu_clock;
+    int _fd;
+
+    uint64_t _start_time;
+    uint64_t _last_sample_time;
+    uint64_t _last_sample_cpu_time;
+    uint64_t _end_time;
+    uint64_t _samples;
+    uint64_t _missed_ticks;
+    uint64_t _idle_ticks;
+    uint64_t _rate_changes;
+    Histogram _intervals;
+};
+
+#endif /* SCHEDULER_H */
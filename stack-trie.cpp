@@ -0,0 +1,88 @@
+//
+//  stack-trie.cpp
+//  drspin
+//
+
+#include "stack-trie.h"
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+
+StackTrie::StackTrie() {
+    _nodes.push_back({ .address = 0, .parent = none });
+}
+
+StackTrie::NodeID StackTrie::child(const NodeID parent, const uintptr_t address) {
+    const auto [entry, inserted] = _children.try_emplace({ .parent = parent, .address = address }, (NodeID)_nodes.size());
+
+    if (inserted) {
+        assert(_nodes.size() < none);
+
+        _nodes.push_back({ .address = address, .parent = parent });
+    }
+
+    return entry->second;
+}
+
+StackTrie::NodeID StackTrie::intern(const std::vector<uintptr_t> &stack) {
+    NodeID node = root;
+
+    for (auto iter = stack.rbegin(); iter != stack.rend(); iter++) {
+        node = child(node, *iter);
+    }
+
+    return node;
+}
+
+void StackTrie::frames(NodeID node, std::vector<uintptr_t> &frames) const {
+    frames.clear();
+
+    for (; node != root; node = _nodes[node].parent) {
+        frames.push_back(_nodes[node].address);
+    }
+
+    std::reverse(frames.begin(), frames.end());
+}
+
+std::vector<uintptr_t> StackTrie::addresses() const {
+    std::vector<uintptr_t> addresses;
+    addresses.reserve(_nodes.size() - 1);
+
+    for (NodeID node = 1; node < _nodes.size(); node++) {
+        addresses.push_back(_nodes[node].address);
+    }
+
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    return addresses;
+}
+
+std::vector<uintptr_t> StackTrie::return_addresses() const {
+    std::vector<uintptr_t> addresses;
+
+    for (NodeID node = 1; node < _nodes.size(); node++) {
+        const NodeID parent = _nodes[node].parent;
+
+        if (parent != root) {
+            addresses.push_back(_nodes[parent].address);
+        }
+    }
+
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    return addresses;
+}
+
+size_t StackTrie::size() const {
+    return _nodes.size();
+}
+
+uintptr_t StackTrie::address(const NodeID node) const {
+    return _nodes[node].address;
+}
+
+StackTrie::NodeID StackTrie::parent(const NodeID node) const {
+    return _nodes[node].parent;
+}
@@ -0,0 +1,51 @@
+//
+//  stack-trie.h
+//  drspin
+//
+
+#include "trie-edge.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#ifndef STACK_TRIE_H
+#define STACK_TRIE_H
+
+// Interns call stacks into a prefix tree as they are captured.  Each distinct stack is identified by the node for its innermost frame, so a sample costs one node ID no matter how deep it is, and memory scales with the number of unique stacks rather than the number of samples.
+struct StackTrie {
+    using NodeID = uint32_t;
+    static constexpr NodeID root = 0;
+    static constexpr NodeID none = UINT32_MAX;
+
+    StackTrie();
+
+    // Interns a stack given innermost frame first (the order the unwinder produces), and returns its node.
+    NodeID intern(const std::vector<uintptr_t> &stack);
+
+    // Returns the node for `address` called from `parent`, creating it if necessary.
+    NodeID child(NodeID parent, uintptr_t address);
+
+    // Replaces the contents of `frames` with the stack ending at `node`, outermost frame first.
+    void frames(NodeID node, std::vector<uintptr_t> &frames) const;
+
+    // Returns every distinct address in the trie, sorted.
+    std::vector<uintptr_t> addresses() const;
+
+    // Returns every distinct address that appears as a caller's frame (i.e., whose node has children), sorted.  These are return addresses rather than sampled PCs.
+    std::vector<uintptr_t> return_addresses() const;
+
+    size_t size() const;
+    uintptr_t address(NodeID node) const;
+    NodeID parent(NodeID node) const;
+private:
+    struct Node {
+        uintptr_t address;
+        NodeID parent;
+    };
+
+    std::vector<Node> _nodes;
+    std::unordered_map<TrieEdge, NodeID, TrieEdge::Hash> _children;
+};
+
+#endif /* STACK_TRIE_H */
@@ -0,0 +1,80 @@
+//
+//  symbol-cache.cpp
+//  drspin
+//
+
+#include "symbol-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+SymbolIndexCache::SymbolIndexCache(const std::string directory)
+: _directory(directory) { }
+
+std::string SymbolIndexCache::default_directory() {
+    if (const char *const directory = getenv("DRSPIN_CACHE_DIR")) {
+        return directory;
+    } else if (const char *const directory = getenv("XDG_CACHE_HOME")) {
+        return std::string(directory) + "/drspin";
+    } else if (const char *const home = getenv("HOME")) {
+        return std::string(home) + "/.cache/drspin";
+    } else {
+        // /tmp is shared, so the cache there is per-user.
+        return "/tmp/drspin-cache-" + std::to_string(geteuid());
+    }
+}
+
+bool SymbolIndexCache::trusted() const {
+    struct stat st;
+
+    return lstat(_directory.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+std::string SymbolIndexCache::path(const std::string &key) const {
+    return _directory + "/" + key + ".symbols";
+}
+
+std::unique_ptr<const MappedFile> SymbolIndexCache::find(const std::string &key) const {
+    const std::string path = this->path(key);
+    struct stat st;
+
+    if (!trusted() || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return nullptr;
+    }
+
+    // An entry we can't map is just a miss.
+    return MappedFile::try_map(path);
+}
+
+void SymbolIndexCache::store(const std::string &key, const std::vector<std::pair<const void *, size_t>> &pieces) const {
+    // The directory is created on the first store, private to the user.  Its parents (e.g., ~/.cache) are ordinary directories.
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(_directory).parent_path(), error);
+    mkdir(_directory.c_str(), 0700);
+
+    if (!trusted()) return;
+
+    // Write to a temporary file and rename it into place, so that concurrent runs never see a partial entry.
+    const std::string path = this->path(key);
+    const std::string temporary_path = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE *const file = fopen(temporary_path.c_str(), "w");
+    if (file == NULL) return;
+
+    bool ok = true;
+    for (const auto &[data, size] : pieces) {
+        ok = ok && fwrite(data, 1, size, file) == size;
+    }
+
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temporary_path.c_str(), path.c_str()) != 0) {
+        unlink(temporary_path.c_str());
+    }
+}
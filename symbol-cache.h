@@ -0,0 +1,38 @@
+//
+//  symbol-cache.h
+//  drspin
+//
+
+#include "util.h"
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+// A directory of prebuilt symbol indexes, one file per ELF object, which are mapped directly instead of reparsing the object's symbol tables on every run.
+//
+// Entries are keyed by the object's build ID or, for objects without one, by a hash of its path, size, and modification time.  The format of each entry is up to Library; the cache just stores and maps files.
+struct SymbolIndexCache {
+    SymbolIndexCache(std::string directory);
+
+    // $DRSPIN_CACHE_DIR if it's set, or else drspin/ under the user's cache directory, or failing those /tmp/drspin-cache-<uid>.  Only computes the path; the directory is created by the first store().
+    static std::string default_directory();
+
+    // Returns the mapped entry for `key`, or nullptr if there isn't one (or it can't be read).
+    std::unique_ptr<const MappedFile> find(const std::string &key) const;
+
+    // Writes the concatenation of `pieces` as the entry for `key`.  Failures (e.g., a read-only cache directory) are silently ignored: the cache is only an optimization.
+    void store(const std::string &key, const std::vector<std::pair<const void *, size_t>> &pieces) const;
+private:
+    // Whether the directory is one we can trust not to hold entries planted by someone else: a real directory (not a symlink), owned by the effective user, that nobody else can write.  Otherwise (e.g., under sudo with the invoking user's $HOME) the cache is neither read nor written.
+    bool trusted() const;
+
+    std::string path(const std::string &key) const;
+    std::string _directory;
+};
+
+#endif /* SYMBOL_CACHE_H */
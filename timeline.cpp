@@ -0,0 +1,70 @@
+//
+//  timeline.cpp
+//  drspin
+//
+
+#include "timeline.h"
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+Timeline::Timeline()
+: _size(0), _last_timestamp(0), _last_stack(StackTrie::root) { }
+
+void Timeline::add(const uint64_t timestamp, const StackTrie::NodeID stack, const bool on_cpu) {
+    // The first sample's delta is its whole timestamp.
+    const uint64_t delta = (timestamp > _last_timestamp) ? timestamp - _last_timestamp : 0;
+    const int64_t stack_delta = (int64_t)stack - (int64_t)_last_stack;
+
+    write_varint((delta << 1) | on_cpu);
+    write_varint(((uint64_t)stack_delta << 1) ^ (uint64_t)(stack_delta >> 63));
+
+    _last_timestamp += delta;
+    _last_stack = stack;
+    _size++;
+}
+
+size_t Timeline::size() const {
+    return _size;
+}
+
+size_t Timeline::encoded_size() const {
+    return _bytes.size();
+}
+
+void Timeline::write_varint(uint64_t value) {
+    while (value >= 0x80) {
+        _bytes.push_back((uint8_t)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    _bytes.push_back((uint8_t)value);
+}
+
+Timeline::Cursor::Cursor(const Timeline &timeline)
+: _position(timeline._bytes.data()), _end(timeline._bytes.data() + timeline._bytes.size()), _timestamp(0), _stack(StackTrie::root) { }
+
+bool Timeline::Cursor::next(Sample &sample) {
+    if (_position == _end) return false;
+
+    const uint64_t time = read_varint();
+    const uint64_t stack = read_varint();
+
+    _timestamp += time >> 1;
+    _stack += (StackTrie::NodeID)((stack >> 1) ^ -(stack & 1));
+
+    sample = { .timestamp = _timestamp, .stack = _stack, .on_cpu = (bool)(time & 1) };
+    return true;
+}
+
+uint64_t Timeline::Cursor::read_varint() {
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0;; shift += 7) {
+        assert(_position != _end);
+        const uint8_t byte = *_position++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) return value;
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  timeline.h
+//  drspin
+//
+
+#include "stack-trie.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+// A thread's samples in the order they were taken, for exporters that show when things happened rather than just how often.
+//
+// Samples are packed into a byte string of unsigned LEB128 varints, two per sample: the nanoseconds since the thread's previous sample, times 2, plus 1 if the thread was on a CPU; and the sample's stack node minus the previous sample's, zigzag-encoded.  At 1000 Hz with a stack that changes only occasionally, that's 4 bytes per sample.
+struct Timeline {
+    Timeline();
+
+    // Appends a sample.  A timestamp earlier than the previous sample's is taken to be the same as it.
+    void add(uint64_t timestamp, StackTrie::NodeID stack, bool on_cpu);
+
+    size_t size() const;
+
+    // The size of the encoded samples, in bytes.
+    size_t encoded_size() const;
+
+    struct Sample {
+        uint64_t timestamp;
+        StackTrie::NodeID stack;
+        bool on_cpu;
+    };
+
+    // Decodes the samples one at a time, in order.
+    struct Cursor {
+        Cursor(const Timeline &timeline);
+
+        // Decodes the next sample into `sample`.  Returns false if there are no more.
+        bool next(Sample &sample);
+    private:
+        uint64_t read_varint();
+
+        const uint8_t *_position;
+        const uint8_t *_end;
+        uint64_t _timestamp;
+        StackTrie::NodeID _stack;
+    };
+private:
+    void write_varint(uint64_t value);
+
+    std::vector<uint8_t> _bytes;
+    size_t _size;
+    uint64_t _last_timestamp;
+    StackTrie::NodeID _last_stack;
+};
+
+#endif /* TIMELINE_H */
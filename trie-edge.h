@@ -0,0 +1,29 @@
+//
+//  trie-edge.h
+//  drspin
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+#ifndef TRIE_EDGE_H
+#define TRIE_EDGE_H
+
+// The key of a child in a prefix tree of addresses (see StackTrie and CallTree): its parent's node ID and its own address.  The trees map these to child nodes, so adding a stack is one hash lookup per frame.
+struct TrieEdge {
+    uint32_t parent;
+    uintptr_t address;
+
+    bool operator==(const TrieEdge &other) const {
+        return parent == other.parent && address == other.address;
+    }
+
+    struct Hash {
+        size_t operator()(const TrieEdge &edge) const {
+            return std::hash<uintptr_t>()(edge.address) ^ ((size_t)edge.parent * 0x9e3779b97f4a7c15);
+        }
+    };
+};
+
+#endif /* TRIE_EDGE_H */
@@ -0,0 +1,492 @@
+//
+//  unwind-table.cpp
+//  drspin
+//
+
+#include "unwind-table.h"
+#include "dwarf-reader.h"
+#include "elf-types.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// DWARF register numbers, from each architecture's psABI.
+#if defined(__x86_64__) && __x86_64__
+const uint64_t dwarf_fp = 6;  // %rbp
+const uint64_t dwarf_sp = 7;  // %rsp
+#elif defined(__aarch64__) && __aarch64__
+const uint64_t dwarf_fp = 29; // x29
+const uint64_t dwarf_sp = 31; // sp
+#else
+#error don't know DWARF register numbers
+#endif
+
+struct CIE {
+    uint64_t code_alignment;
+    int64_t data_alignment;
+    uint64_t return_register;
+    uint8_t fde_encoding;
+    bool augmented; // whether FDEs have augmentation data
+    const uint8_t *instructions;
+    const uint8_t *instructions_end;
+    uintptr_t instructions_address;
+};
+
+static bool parse_cie(DwarfReader reader, CIE &cie) {
+    if (reader.fixed<uint32_t>() != 0) return false; // CIE ID
+
+    const uint8_t version = reader.fixed<uint8_t>();
+    if (version != 1 && version != 3) return false;
+
+    const char *const augmentation = (const char *)reader.position;
+    const size_t augmentation_length = strnlen(augmentation, reader.end - reader.position);
+    reader.skip(augmentation_length + 1);
+
+    // An "eh" augmentation (from ancient GCCs) has a pointer here; it's not worth supporting.
+    if (!strncmp(augmentation, "eh", 2)) return false;
+
+    cie.code_alignment = reader.uleb128();
+    cie.data_alignment = reader.sleb128();
+    cie.return_register = (version == 1) ? reader.fixed<uint8_t>() : reader.uleb128();
+    cie.fde_encoding = PE_ABSPTR;
+    cie.augmented = (augmentation[0] == 'z');
+
+    if (cie.augmented) {
+        const uint64_t length = reader.uleb128();
+        DwarfReader data(reader.position, reader.position + std::min((size_t)length, (size_t)(reader.end - reader.position)), reader.address);
+        reader.skip(length);
+
+        for (const char *p = augmentation + 1; p < augmentation + augmentation_length; p++) {
+            switch (*p) {
+                case 'L': // LSDA encoding
+                    data.fixed<uint8_t>();
+                    break;
+                case 'P': { // personality routine
+                    const uint8_t encoding = data.fixed<uint8_t>();
+                    data.pointer(encoding & ~PE_INDIRECT, 0);
+                    break;
+                }
+                case 'R':
+                    cie.fde_encoding = data.fixed<uint8_t>();
+                    break;
+                case 'S': // signal frame
+                case 'B': // AArch64 BTI
+                case 'G': // AArch64 MTE
+                    break;
+                default:
+                    // The rest of the augmentation data is uninterpretable, but we don't need it.
+                    p = augmentation + augmentation_length - 1;
+                    break;
+            }
+        }
+
+        if (data.error) return false;
+    }
+
+    cie.instructions = reader.position;
+    cie.instructions_end = reader.end;
+    cie.instructions_address = reader.address;
+
+    return !reader.error;
+}
+
+// How to find one of the registers we track in the caller's frame.
+struct RegisterState {
+    enum { UNDEFINED, SAME, OFFSET, OTHER } kind;
+    int64_t offset;
+};
+
+// A row of the CFI table, for the registers we track.
+struct FrameState {
+    uint64_t cfa_register;
+    int64_t cfa_offset;
+    bool cfa_expression;
+    RegisterState ra;
+    RegisterState fp;
+};
+
+struct Row {
+    uintptr_t address;
+    bool end; // the end of an FDE, rather than a row in it
+    FrameState state;
+};
+
+// Runs a CFA program, appending a row to `rows` (if it isn't null) each time the location advances.  `initial` is the state after the CIE's instructions, for DW_CFA_restore.
+static bool execute(DwarfReader reader, const CIE &cie, uintptr_t &location, FrameState &state, const FrameState &initial, std::vector<Row> *const rows) {
+    std::vector<FrameState> remembered;
+
+    const auto set_rule = [&](const uint64_t reg, const RegisterState rule) {
+        if (reg == cie.return_register) {
+            state.ra = rule;
+        } else if (reg == dwarf_fp) {
+            state.fp = rule;
+        }
+    };
+
+    const auto restore = [&](const uint64_t reg) {
+        if (reg == cie.return_register) {
+            state.ra = initial.ra;
+        } else if (reg == dwarf_fp) {
+            state.fp = initial.fp;
+        }
+    };
+
+    const auto advance = [&](const uint64_t delta) {
+        if (rows) rows->push_back({ .address = location, .end = false, .state = state });
+        location += delta * cie.code_alignment;
+    };
+
+    while (reader.position < reader.end && !reader.error) {
+        const uint8_t opcode = reader.fixed<uint8_t>();
+        const uint8_t operand = opcode & 0x3f;
+
+        switch (opcode & 0xc0) {
+            case 0x40: // DW_CFA_advance_loc
+                advance(operand);
+                continue;
+            case 0x80: // DW_CFA_offset
+                set_rule(operand, { RegisterState::OFFSET, (int64_t)reader.uleb128() * cie.data_alignment });
+                continue;
+            case 0xc0: // DW_CFA_restore
+                restore(operand);
+                continue;
+        }
+
+        switch (opcode) {
+            case 0x00: // DW_CFA_nop
+                break;
+            case 0x01: { // DW_CFA_set_loc
+                const uintptr_t target = reader.pointer(cie.fde_encoding, 0);
+                if (rows) rows->push_back({ .address = location, .end = false, .state = state });
+                location = target;
+                break;
+            }
+            case 0x02: // DW_CFA_advance_loc1
+                advance(reader.fixed<uint8_t>());
+                break;
+            case 0x03: // DW_CFA_advance_loc2
+                advance(reader.fixed<uint16_t>());
+                break;
+            case 0x04: // DW_CFA_advance_loc4
+                advance(reader.fixed<uint32_t>());
+                break;
+            case 0x05: { // DW_CFA_offset_extended
+                const uint64_t reg = reader.uleb128();
+                set_rule(reg, { RegisterState::OFFSET, (int64_t)reader.uleb128() * cie.data_alignment });
+                break;
+            }
+            case 0x06: // DW_CFA_restore_extended
+                restore(reader.uleb128());
+                break;
+            case 0x07: // DW_CFA_undefined
+                set_rule(reader.uleb128(), { RegisterState::UNDEFINED, 0 });
+                break;
+            case 0x08: // DW_CFA_same_value
+                set_rule(reader.uleb128(), { RegisterState::SAME, 0 });
+                break;
+            case 0x09: { // DW_CFA_register
+                const uint64_t reg = reader.uleb128();
+                reader.uleb128();
+                set_rule(reg, { RegisterState::OTHER, 0 });
+                break;
+            }
+            case 0x0a: // DW_CFA_remember_state
+                remembered.push_back(state);
+                break;
+            case 0x0b: { // DW_CFA_restore_state
+                if (remembered.empty()) return false;
+
+                state = remembered.back();
+                remembered.pop_back();
+                break;
+            }
+            case 0x0c: // DW_CFA_def_cfa
+                state.cfa_register = reader.uleb128();
+                state.cfa_offset = (int64_t)reader.uleb128();
+                state.cfa_expression = false;
+                break;
+            case 0x0d: // DW_CFA_def_cfa_register
+                state.cfa_register = reader.uleb128();
+                state.cfa_expression = false;
+                break;
+            case 0x0e: // DW_CFA_def_cfa_offset
+                state.cfa_offset = (int64_t)reader.uleb128();
+                break;
+            case 0x0f: // DW_CFA_def_cfa_expression
+                reader.skip(reader.uleb128());
+                state.cfa_expression = true;
+                break;
+            case 0x10: { // DW_CFA_expression
+                const uint64_t reg = reader.uleb128();
+                reader.skip(reader.uleb128());
+                set_rule(reg, { RegisterState::OTHER, 0 });
+                break;
+            }
+            case 0x11: { // DW_CFA_offset_extended_sf
+                const uint64_t reg = reader.uleb128();
+                set_rule(reg, { RegisterState::OFFSET, reader.sleb128() * cie.data_alignment });
+                break;
+            }
+            case 0x12: // DW_CFA_def_cfa_sf
+                state.cfa_register = reader.uleb128();
+                state.cfa_offset = reader.sleb128() * cie.data_alignment;
+                state.cfa_expression = false;
+                break;
+            case 0x13: // DW_CFA_def_cfa_offset_sf
+                state.cfa_offset = reader.sleb128() * cie.data_alignment;
+                break;
+            case 0x14: // DW_CFA_val_offset
+            case 0x15: { // DW_CFA_val_offset_sf
+                const uint64_t reg = reader.uleb128();
+                if (opcode == 0x14) reader.uleb128(); else reader.sleb128();
+                set_rule(reg, { RegisterState::OTHER, 0 });
+                break;
+            }
+            case 0x16: { // DW_CFA_val_expression
+                const uint64_t reg = reader.uleb128();
+                reader.skip(reader.uleb128());
+                set_rule(reg, { RegisterState::OTHER, 0 });
+                break;
+            }
+            case 0x2d: // DW_CFA_AARCH64_negate_ra_state: the return address is signed, which the unwinder deals with by stripping the signature from every return address.
+                break;
+            case 0x2e: // DW_CFA_GNU_args_size
+                reader.uleb128();
+                break;
+            case 0x2f: { // DW_CFA_GNU_negative_offset_extended
+                const uint64_t reg = reader.uleb128();
+                set_rule(reg, { RegisterState::OFFSET, -(int64_t)reader.uleb128() * cie.data_alignment });
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return !reader.error;
+}
+
+// Converts a row to a compact rule, or a CFA_NONE rule if it uses something the unwinder doesn't track.
+static UnwindTable::Rule compile(const FrameState &state) {
+    UnwindTable::Rule rule = {
+        .start = 0,
+        .cfa_offset = 0,
+        .ra_offset = 0,
+        .fp_offset = 0,
+        .cfa = UnwindTable::CFA_NONE,
+        .ra = UnwindTable::RULE_UNDEFINED,
+        .fp = UnwindTable::RULE_UNDEFINED,
+    };
+
+    const auto fits = [](const int64_t value, const int64_t min, const int64_t max) {
+        return value >= min && value <= max;
+    };
+
+    if (state.cfa_expression || !fits(state.cfa_offset, INT32_MIN, INT32_MAX)) return rule;
+
+    if (state.cfa_register == dwarf_sp) {
+        rule.cfa = UnwindTable::CFA_SP;
+    } else if (state.cfa_register == dwarf_fp) {
+        rule.cfa = UnwindTable::CFA_FP;
+    } else {
+        return rule;
+    }
+
+    rule.cfa_offset = (int32_t)state.cfa_offset;
+
+    switch (state.ra.kind) {
+        case RegisterState::UNDEFINED:
+            rule.ra = UnwindTable::RULE_UNDEFINED;
+            break;
+        case RegisterState::SAME:
+            rule.ra = UnwindTable::RULE_SAME;
+            break;
+        case RegisterState::OFFSET:
+            if (!fits(state.ra.offset, INT16_MIN, INT16_MAX)) {
+                rule.cfa = UnwindTable::CFA_NONE;
+                return rule;
+            }
+
+            rule.ra = UnwindTable::RULE_OFFSET;
+            rule.ra_offset = (int16_t)state.ra.offset;
+            break;
+        case RegisterState::OTHER:
+            rule.cfa = UnwindTable::CFA_NONE;
+            return rule;
+    }
+
+    if (state.fp.kind == RegisterState::SAME) {
+        rule.fp = UnwindTable::RULE_SAME;
+    } else if (state.fp.kind == RegisterState::OFFSET && fits(state.fp.offset, INT16_MIN, INT16_MAX)) {
+        rule.fp = UnwindTable::RULE_OFFSET;
+        rule.fp_offset = (int16_t)state.fp.offset;
+    }
+
+    return rule;
+}
+
+UnwindTable::UnwindTable()
+: _base_address(0) { }
+
+UnwindTable::UnwindTable(const MappedFile &file, const uintptr_t base_address)
+: _base_address(base_address) {
+    const uint8_t *const bytes = file.read<uint8_t>(0);
+    const size_t size = file.size();
+
+    if (size < sizeof (Elf_Ehdr) || memcmp(bytes, ELFMAG, SELFMAG)) return;
+
+    const Elf_Ehdr *const header = file.read<Elf_Ehdr>(0);
+    if (header->e_phoff > size || header->e_phnum > (size - header->e_phoff) / sizeof (Elf_Phdr)) return;
+
+    const StaticUnownedArray<Elf_Phdr> phdrs = file.read_array<Elf_Phdr>(header->e_phoff, header->e_phnum);
+
+    // Returns a reader for the file bytes of the loaded segment containing an unslid address, starting at that address.
+    const auto reader_at = [&](const uintptr_t address) {
+        for (const Elf_Phdr &phdr : phdrs) {
+            if (phdr.p_type != PT_LOAD || address < phdr.p_vaddr || address - phdr.p_vaddr >= phdr.p_filesz) continue;
+            if (phdr.p_offset > size || phdr.p_filesz > size - phdr.p_offset) break;
+
+            const uint8_t *const segment = bytes + phdr.p_offset;
+            return DwarfReader(segment + (address - phdr.p_vaddr), segment + phdr.p_filesz, address);
+        }
+
+        DwarfReader reader(bytes, bytes, 0);
+        reader.error = true;
+        return reader;
+    };
+
+    // Find the FDEs through .eh_frame_hdr's search table, which the linker sorts by address, and which (unlike .eh_frame's section header) is found through the program headers, so it survives stripping.
+    const Elf_Phdr *eh_frame_hdr = nullptr;
+
+    for (const Elf_Phdr &phdr : phdrs) {
+        if (phdr.p_type == PT_GNU_EH_FRAME) eh_frame_hdr = &phdr;
+    }
+
+    if (eh_frame_hdr == nullptr) return;
+
+    const uintptr_t hdr_address = eh_frame_hdr->p_vaddr;
+    DwarfReader hdr = reader_at(hdr_address);
+
+    const uint8_t version = hdr.fixed<uint8_t>();
+    const uint8_t eh_frame_ptr_encoding = hdr.fixed<uint8_t>();
+    const uint8_t fde_count_encoding = hdr.fixed<uint8_t>();
+    const uint8_t table_encoding = hdr.fixed<uint8_t>();
+
+    if (version != 1 || eh_frame_ptr_encoding == PE_OMIT || fde_count_encoding == PE_OMIT || table_encoding == PE_OMIT) return;
+
+    hdr.pointer(eh_frame_ptr_encoding, hdr_address);
+    const size_t fde_count = hdr.pointer(fde_count_encoding, hdr_address);
+    if (hdr.error) return;
+
+    std::unordered_map<uintptr_t, CIE> cies;
+    std::vector<Row> rows;
+
+    for (size_t i = 0; i < fde_count && !hdr.error; i++) {
+        hdr.pointer(table_encoding, hdr_address); // initial location
+        const uintptr_t fde_address = hdr.pointer(table_encoding, hdr_address);
+        if (hdr.error) break;
+
+        DwarfReader fde = reader_at(fde_address).entry();
+        if (fde.error) continue;
+
+        const uintptr_t cie_pointer_address = fde.address;
+        const uint32_t cie_pointer = fde.fixed<uint32_t>();
+        if (cie_pointer == 0) continue;
+
+        const uintptr_t cie_address = cie_pointer_address - cie_pointer;
+        auto entry = cies.find(cie_address);
+
+        if (entry == cies.end()) {
+            CIE cie;
+            const DwarfReader cie_reader = reader_at(cie_address).entry();
+            if (cie_reader.error || !parse_cie(cie_reader, cie)) continue;
+
+            entry = cies.emplace(cie_address, cie).first;
+        }
+
+        const CIE &cie = entry->second;
+        const uintptr_t start = fde.pointer(cie.fde_encoding, 0);
+        const uintptr_t length = fde.pointer(cie.fde_encoding & 0x0f, 0);
+
+        if (cie.augmented) {
+            fde.skip(fde.uleb128());
+        }
+
+        if (fde.error || length == 0) continue;
+
+        // Every register we track starts out unchanged, and the CIE sets up the CFA (and usually the return address).
+        FrameState initial = {
+            .cfa_register = UINT64_MAX,
+            .cfa_offset = 0,
+            .cfa_expression = false,
+            .ra = { RegisterState::SAME, 0 },
+            .fp = { RegisterState::SAME, 0 },
+        };
+
+        uintptr_t location = start;
+        if (!execute(DwarfReader(cie.instructions, cie.instructions_end, cie.instructions_address), cie, location, initial, initial, nullptr)) continue;
+
+        const size_t first_row = rows.size();
+        FrameState state = initial;
+        location = start;
+
+        if (!execute(fde, cie, location, state, initial, &rows)) {
+            rows.resize(first_row);
+            continue;
+        }
+
+        rows.push_back({ .address = location, .end = false, .state = state });
+        rows.push_back({ .address = start + length, .end = true, .state = initial });
+
+        // Drop rows past the end of the FDE, which only bad CFI would have.
+        rows.erase(std::remove_if(rows.begin() + first_row, rows.end() - 1, [&](const Row &row) {
+            return row.address >= start + length;
+        }), rows.end() - 1);
+    }
+
+    // Where one FDE ends and the next starts, the start wins.  Where the location didn't advance between rows, the later row wins.
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        if (a.address != b.address) return a.address < b.address;
+        return a.end > b.end;
+    });
+
+    const Rule none = { .start = 0, .cfa_offset = 0, .ra_offset = 0, .fp_offset = 0, .cfa = CFA_NONE, .ra = RULE_UNDEFINED, .fp = RULE_UNDEFINED };
+    const auto same = [](const Rule &a, const Rule &b) {
+        return a.cfa == b.cfa && a.cfa_offset == b.cfa_offset && a.ra == b.ra && a.ra_offset == b.ra_offset && a.fp == b.fp && a.fp_offset == b.fp_offset;
+    };
+
+    for (size_t i = 0; i < rows.size(); i++) {
+        const Row &row = rows[i];
+        if (i + 1 < rows.size() && rows[i + 1].address == row.address) continue;
+        if (row.address < base_address || row.address - base_address > UINT32_MAX) continue;
+
+        Rule rule = row.end ? none : compile(row.state);
+        rule.start = (uint32_t)(row.address - base_address);
+
+        // Consecutive rows often differ only in registers we don't track.
+        if (!_rules.empty() && same(_rules.back(), rule)) continue;
+
+        _rules.push_back(rule);
+    }
+
+    _rules.shrink_to_fit();
+}
+
+const UnwindTable::Rule *UnwindTable::find(const uintptr_t address) const {
+    if (address < _base_address || address - _base_address > UINT32_MAX) return nullptr;
+
+    const uint32_t offset = (uint32_t)(address - _base_address);
+    const auto iter = std::upper_bound(_rules.begin(), _rules.end(), offset, [](const uint32_t offset, const Rule &rule) {
+        return offset < rule.start;
+    });
+
+    if (iter == _rules.begin() || (iter - 1)->cfa == CFA_NONE) return nullptr;
+
+    return &*(iter - 1);
+}
+
+size_t UnwindTable::size() const {
+    return _rules.size();
+}
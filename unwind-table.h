@@ -0,0 +1,57 @@
+//
+//  unwind-table.h
+//  drspin
+//
+
+#include "util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef UNWIND_TABLE_H
+#define UNWIND_TABLE_H
+
+// An object's call frame information (CFI), compiled from its .eh_frame into a sorted array of compact rules, each of which says how to find the caller's frame from any PC in a range.
+//
+// Only the registers the unwinder tracks are kept: the CFA (canonical frame address, which is the caller's SP) must be the SP or FP plus an offset, and the return address and caller's FP must each be unchanged or saved at an offset from the CFA.  That covers nearly all compiler-generated code; anything else (e.g., CFA expressions in PLT stubs) gets no rule, and the unwinder falls back on the frame pointer there.
+struct UnwindTable {
+    enum CFARule : uint8_t {
+        CFA_NONE,    // not covered by CFI we understand
+        CFA_SP,
+        CFA_FP,
+    };
+
+    enum RegisterRule : uint8_t {
+        RULE_UNDEFINED, // for the return address, the outermost frame; for the FP, not recoverable
+        RULE_SAME,      // still in its register (e.g., the return address in the link register, in a leaf function)
+        RULE_OFFSET,    // saved at the CFA plus the offset
+    };
+
+    struct Rule {
+        uint32_t start; // the offset from the object's base address at which the rule starts to apply
+        int32_t cfa_offset;
+        int16_t ra_offset;
+        int16_t fp_offset;
+        CFARule cfa;
+        RegisterRule ra;
+        RegisterRule fp;
+    };
+
+    // An empty table, for objects we can't read.
+    UnwindTable();
+
+    // Compiles the CFI of the ELF object mapped at `file`, whose first segment is at unslid address `base_address`.  The table doesn't refer to the file afterward.
+    UnwindTable(const MappedFile &file, uintptr_t base_address);
+
+    // Returns the rule for an unslid address, or null if there isn't one.
+    const Rule *find(uintptr_t address) const;
+
+    size_t size() const;
+private:
+    uintptr_t _base_address;
+
+    // Sorted by start.  A rule applies until the next one starts; gaps between functions are filled with CFA_NONE rules.
+    std::vector<Rule> _rules;
+};
+
+#endif /* UNWIND_TABLE_H */
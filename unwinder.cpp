@@ -0,0 +1,189 @@
+//
+//  unwinder.cpp
+//  drspin
+//
+
+#include "unwinder.h"
+#include "unwind-table.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// No sane frame is bigger than this, so a bigger step means we've gone off the rails.
+const uintptr_t max_frame_size = 1024 * 1024;
+
+Unwinder::Unwinder(RemoteMemory &memory, const size_t window_size, const size_t check_size)
+: _memory(memory), _check_size(check_size), _window(window_size / sizeof (uintptr_t)), _window_start(0), _window_end(0), _check_buffer(check_size) { }
+
+bool Unwinder::unchanged(const lwpid_t lwpid, const Registers &regs) {
+    const auto entry = _last_unwinds.find(lwpid);
+    if (entry == _last_unwinds.end()) return false;
+
+    const LastUnwind &last = entry->second;
+
+    if (regs.pc != last.regs.pc || regs.fp != last.regs.fp || regs.sp != last.regs.sp || regs.lr != last.regs.lr) {
+        return false;
+    }
+
+    if (last.check_length > 0) {
+        if (_memory.read_direct(regs.sp, _check_buffer.data(), last.check_length) != last.check_length) {
+            return false;
+        }
+
+        return hash_bytes(_check_buffer.data(), last.check_length) == last.check_hash;
+    }
+
+    return true;
+}
+
+std::vector<uintptr_t> Unwinder::unwind(const lwpid_t lwpid, const Registers &regs) {
+    std::vector<uintptr_t> stack;
+
+    // The stack probably doesn't extend all the way to the end of the window, in which case we get a short read.
+    _window_start = regs.sp;
+    _window_end = _window_start + _memory.read_direct(_window_start, _window.data(), _window.size() * sizeof (uintptr_t));
+
+    // The top of the stack is already in the window, so the hash for unchanged() is nearly free.  (If the window is smaller than the check size, the check just reads less.)
+    const size_t check_length = std::min(_check_size, (size_t)(_window_end - _window_start));
+    _last_unwinds[lwpid] = {
+        .regs = regs,
+        .check_length = check_length,
+        .check_hash = hash_bytes(_window.data(), check_length),
+    };
+
+    walk(regs, stack);
+    return stack;
+}
+
+void Unwinder::reset() {
+    _last_unwinds.clear();
+}
+
+void Unwinder::set_libraries(ELFSymbolicator *const libraries) { }
+
+void Unwinder::prepare_libraries() { }
+
+bool Unwinder::read_stack(const uintptr_t address, uintptr_t *const words, const size_t count) {
+    const size_t size = count * sizeof (uintptr_t);
+
+    if (address >= _window_start && address <= _window_end && _window_end - address >= size && address % sizeof (uintptr_t) == 0) {
+        memcpy(words, &_window[(address - _window_start) / sizeof (uintptr_t)], size);
+        return true;
+    }
+
+    return _memory.read(address, words, size);
+}
+
+FramePointerUnwinder::FramePointerUnwinder(RemoteMemory &memory, const size_t window_size, const size_t check_size)
+: Unwinder(memory, window_size, check_size) { }
+
+void FramePointerUnwinder::walk(const Registers &regs, std::vector<uintptr_t> &stack) {
+    uintptr_t pc = regs.pc;
+    uintptr_t fp = regs.fp;
+
+    for (;;) {
+#if 0
+        printf("pc == %lx, fp == %lx\n", pc, fp);
+#endif /* 0 */
+        stack.push_back(pc);
+
+        uintptr_t data[2];
+        const bool fault = !read_stack(fp, data, 2);
+
+#if (defined(__x86_64__) && __x86_64__) || (defined(__aarch64__) && __aarch64__)
+        const uintptr_t next_fp = data[0];
+        const uintptr_t next_pc = data[1];
+#else
+#error don't know how to get next pc/fp
+#endif
+
+        if (fault || next_fp <= fp || next_fp - fp > max_frame_size) {
+#if 0
+            printf("next_fp: %lx (fault: %s)\n", next_fp, fault ? "YES" : "NO");
+#endif /* 0 */
+            break;
+        }
+
+        pc = next_pc;
+        fp = next_fp;
+    }
+}
+
+DwarfUnwinder::DwarfUnwinder(RemoteMemory &memory, const size_t window_size, const size_t check_size)
+: Unwinder(memory, window_size, check_size), _libraries(nullptr) { }
+
+void DwarfUnwinder::set_libraries(ELFSymbolicator *const libraries) {
+    _libraries = libraries;
+}
+
+void DwarfUnwinder::prepare_libraries() {
+    // Compiling the CFI lazily would stretch the first samples that land in each library, while the target is stopped.
+    if (_libraries) {
+        _libraries->build_unwind_tables();
+    }
+}
+
+void DwarfUnwinder::walk(const Registers &regs, std::vector<uintptr_t> &stack) {
+    uintptr_t pc = regs.pc;
+    uintptr_t sp = regs.sp;
+    uintptr_t fp = regs.fp; // 0 if the CFI doesn't say where the caller's FP is
+    uintptr_t lr = regs.lr;
+
+    for (;;) {
+        stack.push_back(pc);
+
+        // Every frame but the innermost was interrupted at a return address, which follows the call and may even be the start of the next function (if the callee doesn't return), so look up the call instead.
+        const uintptr_t lookup_pc = (stack.size() == 1) ? pc : pc - 1;
+        const UnwindTable::Rule *const rule = _libraries ? _libraries->unwind_rule(lookup_pc) : nullptr;
+
+        uintptr_t cfa, next_pc, next_fp;
+
+        if (rule == nullptr) {
+            // No CFI, so hope for a frame record.  The caller's SP is just above it on x86-64, and at least that far up on AArch64.
+            uintptr_t record[2];
+            if (fp == 0 || !read_stack(fp, record, 2)) break;
+
+            next_fp = record[0];
+            next_pc = record[1];
+            if (next_fp <= fp || next_fp - fp > max_frame_size) break;
+
+            cfa = fp + sizeof (record);
+        } else {
+            // The return address is undefined in the outermost frame.
+            if (rule->ra == UnwindTable::RULE_UNDEFINED) break;
+            if (rule->cfa == UnwindTable::CFA_FP && fp == 0) break;
+
+            cfa = ((rule->cfa == UnwindTable::CFA_SP) ? sp : fp) + rule->cfa_offset;
+
+            if (rule->ra == UnwindTable::RULE_SAME) {
+                next_pc = lr;
+            } else if (!read_stack(cfa + rule->ra_offset, &next_pc, 1)) {
+                break;
+            }
+
+            if (rule->fp == UnwindTable::RULE_SAME) {
+                next_fp = fp;
+            } else if (rule->fp == UnwindTable::RULE_UNDEFINED) {
+                next_fp = 0;
+            } else if (!read_stack(cfa + rule->fp_offset, &next_fp, 1)) {
+                break;
+            }
+        }
+
+        // The stack grows down, so each caller's frame is above its callee's.  Only the innermost frame can be empty (in a leaf function that doesn't touch the stack).
+        if (cfa < sp || (cfa == sp && stack.size() > 1) || cfa - sp > max_frame_size || next_pc == 0) {
+            break;
+        }
+
+#if defined(__aarch64__) && __aarch64__
+        // With pointer authentication, saved return addresses carry a signature in their upper bits.  User addresses fit in 48 bits, so just strip it.
+        next_pc &= ((uintptr_t)1 << 48) - 1;
+#endif
+
+        pc = next_pc;
+        sp = cfa;
+        fp = next_fp;
+        lr = next_pc;
+    }
+}
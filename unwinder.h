@@ -0,0 +1,83 @@
+//
+//  unwinder.h
+//  drspin
+//
+
+#include "elf-symbolicator.h"
+#include "remote-memory.h"
+#include "sampler.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#ifndef UNWINDER_H
+#define UNWINDER_H
+
+// Walks the stack of a stopped thread.  Subclasses decide how to get from one frame to the next.
+//
+// Rather than reading each frame from the target separately, we copy a window of the stack (starting at the thread's SP) in a single read, walk it locally, and only go back to the target (through the page cache) for frames outside the window.
+//
+// Most threads of a typical server are parked in a blocking syscall, so we also remember each thread's registers from its last unwind.  If they haven't changed, neither has the stack, and the caller can skip unwinding.
+struct Unwinder {
+    static constexpr size_t default_window_size = 32 * 1024;
+
+    // If `check_size` is nonzero, unchanged() also compares a hash of that many bytes at the top of the stack, in case the thread ran and happened to end up with the same registers.
+    Unwinder(RemoteMemory &memory, size_t window_size, size_t check_size);
+    virtual ~Unwinder() = default;
+
+    // Returns whether the thread's registers (and checked stack bytes) are the same as at its last unwind.
+    bool unchanged(lwpid_t lwpid, const Registers &regs);
+
+    // Returns the return addresses of the thread's stack, innermost first.
+    std::vector<uintptr_t> unwind(lwpid_t lwpid, const Registers &regs);
+
+    // Forgets every thread's last unwind, e.g., when starting a new profile whose threads have no last sample to repeat.
+    void reset();
+
+    // Tells the unwinder where the target's libraries are.  `libraries` must outlive any unwinding with it.  Unwinders that don't need them ignore them.
+    virtual void set_libraries(ELFSymbolicator *libraries);
+
+    // Does any expensive preparation of the libraries (e.g., compiling their CFI) now rather than during a sample.  Call while the target is running, after set_libraries().
+    virtual void prepare_libraries();
+protected:
+    // Appends the return addresses of the stack whose registers are `regs` to `stack`.  The stack is in the window.
+    virtual void walk(const Registers &regs, std::vector<uintptr_t> &stack) = 0;
+
+    // Reads `count` words of the stack at `address`, from the window if they're all in it and from the target otherwise.  Returns false if they can't be read.
+    bool read_stack(uintptr_t address, uintptr_t *words, size_t count);
+private:
+    struct LastUnwind {
+        Registers regs;
+        size_t check_length;
+        uint64_t check_hash;
+    };
+
+    RemoteMemory &_memory;
+    const size_t _check_size;
+    std::vector<uintptr_t> _window;
+    uintptr_t _window_start;
+    uintptr_t _window_end;
+    std::vector<char> _check_buffer;
+    std::unordered_map<lwpid_t, LastUnwind> _last_unwinds;
+};
+
+// Follows the chain of frame records.  This is cheap, but stops at the first function built without a frame pointer.
+struct FramePointerUnwinder : public Unwinder {
+    FramePointerUnwinder(RemoteMemory &memory, size_t window_size, size_t check_size);
+protected:
+    void walk(const Registers &regs, std::vector<uintptr_t> &stack);
+};
+
+// Follows the call frame information in each library's .eh_frame (see UnwindTable), so it can walk through code built with -fomit-frame-pointer.  Code without CFI (e.g., JIT-compiled code, or libraries loaded since set_libraries()) is walked with the frame pointer instead.
+struct DwarfUnwinder : public Unwinder {
+    DwarfUnwinder(RemoteMemory &memory, size_t window_size, size_t check_size);
+    void set_libraries(ELFSymbolicator *libraries);
+    void prepare_libraries();
+protected:
+    void walk(const Registers &regs, std::vector<uintptr_t> &stack);
+private:
+    ELFSymbolicator *_libraries;
+};
+
+#endif /* UNWINDER_H */
@@ -7,8 +7,17 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -57,6 +66,28 @@ struct MappedFile : public DeleteImplicit {
         close(fd);
     }
 
+    // Maps `path`, or returns nullptr if it can't be opened or mapped, for files (like cache entries) whose absence or damage isn't an error.
+    static std::unique_ptr<const MappedFile> try_map(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) return nullptr;
+
+        struct stat st;
+        void *va = MAP_FAILED;
+
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            va = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+
+        close(fd);
+
+        if (va == MAP_FAILED) return nullptr;
+        return std::unique_ptr<const MappedFile>(new MappedFile(va, st.st_size));
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
     template<typename T>
     const T *read(const size_t offset) const {
         return (const T *)((const char *)_va + offset);
@@ -72,12 +103,171 @@ struct MappedFile : public DeleteImplicit {
         assert(!rv);
     }
 private:
+    MappedFile(const void *const va, const size_t size)
+    : _va(va), _size(size) { }
+
     const void *_va;
     size_t _size;
 };
 
+// FNV-1a.
+inline uint64_t hash_bytes(const void *const bytes, const size_t length, uint64_t hash = 0xcbf29ce484222325) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ ((const unsigned char *)bytes)[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+// Holds strings for as long as the arena exists, carved out of large chunks so that many small strings don't each cost an allocation.  Safe to use concurrently.
+struct StringArena : private DeleteImplicit {
+    StringArena()
+    : _next(nullptr), _remaining(0) { }
+
+    // Returns a NUL-terminated copy of `string`.
+    const char *copy(const char *const string) {
+        const size_t size = strlen(string) + 1;
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if (size > _remaining) {
+            const size_t chunk_size = std::max(size, (size_t)64 * 1024);
+            _chunks.push_back(std::make_unique<char[]>(chunk_size));
+            _next = _chunks.back().get();
+            _remaining = chunk_size;
+        }
+
+        char *const result = _next;
+        memcpy(result, string, size);
+        _next += size;
+        _remaining -= size;
+
+        return result;
+    }
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    char *_next;
+    size_t _remaining;
+};
+
+// The current time in nanoseconds, on a clock that doesn't jump.
+inline uint64_t monotonic_time() {
+    struct timespec ts;
+    const int rv = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(!rv);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Calls `body(i)` for each i in [0, count), in batches spread across a thread per core.
+template<typename Body>
+void parallel_for(const size_t count, const size_t batch_size, Body body) {
+    std::atomic<size_t> next_index(0);
+
+    const auto worker = [&]() {
+        for (;;) {
+            const size_t begin = next_index.fetch_add(batch_size);
+            if (begin >= count) break;
+
+            const size_t end = std::min(begin + batch_size, count);
+            for (size_t i = begin; i < end; i++) {
+                body(i);
+            }
+        }
+    };
+
+    const size_t batch_count = (count + batch_size - 1) / batch_size;
+    const size_t thread_count = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1U), batch_count);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// What an address symbolicates to.
+struct Symbol {
+    // How the text report shows the address, e.g., "main + 16 (in drspin)".
+    std::string description;
+
+    // The function containing the address, and the object containing the function, for exporters that group addresses by function.  Either may be empty if unknown.
+    std::string function;
+    std::string library;
+
+    // The source file and line of the address, if known (and asked for).  The line is 0 if not.  For a return address in a symbol table, they're those of the call instead (see SymbolTable).
+    std::string file;
+    unsigned int line = 0;
+};
+
 struct Symbolicator {
-    virtual std::string symbolicate(uintptr_t address) = 0;
+    virtual Symbol symbolicate(uintptr_t address) = 0;
+
+    // Symbolicates many addresses at once (returning the results in the same order).  Backends that can do better than one address at a time should override this.
+    virtual std::vector<Symbol> symbolicate_batch(const std::vector<uintptr_t> &addresses) {
+        std::vector<Symbol> symbols;
+        symbols.reserve(addresses.size());
+
+        for (const uintptr_t address : addresses) {
+            symbols.push_back(symbolicate(address));
+        }
+
+        return symbols;
+    }
+
+    virtual ~Symbolicator() = default;
+};
+
+// The symbols for a set of addresses, all resolved (in one batch) before a report is rendered.
+struct SymbolTable {
+    // Symbolicates `addresses` in one batch.  Those also in `return_addresses` (sorted) are callers' frames, whose source lines are looked up just before them, at the calls: a return address's own line is whatever follows the call, which may be another statement, or none at all if the call never returns.  The function is still that of the return address itself.
+    SymbolTable(Symbolicator &symbolicator, const std::vector<uintptr_t> &addresses, const std::vector<uintptr_t> &return_addresses) {
+        std::vector<Symbol> symbols = symbolicator.symbolicate_batch(addresses);
+        _symbols.reserve(addresses.size());
+
+        // Only addresses with lines need another lookup, so a symbolicator that gives none (or wasn't asked to) costs nothing more.
+        std::vector<uintptr_t> calls;
+        std::vector<size_t> call_indexes;
+
+        for (size_t i = 0; i < addresses.size(); i++) {
+            if (symbols[i].line != 0 && addresses[i] != 0 && std::binary_search(return_addresses.begin(), return_addresses.end(), addresses[i])) {
+                calls.push_back(addresses[i] - 1);
+                call_indexes.push_back(i);
+            }
+        }
+
+        if (!calls.empty()) {
+            std::vector<Symbol> call_symbols = symbolicator.symbolicate_batch(calls);
+
+            for (size_t j = 0; j < calls.size(); j++) {
+                Symbol &symbol = symbols[call_indexes[j]];
+                symbol.file = std::move(call_symbols[j].file);
+                symbol.line = call_symbols[j].line;
+            }
+        }
+
+        for (size_t i = 0; i < addresses.size(); i++) {
+            _symbols.emplace(addresses[i], std::move(symbols[i]));
+        }
+    }
+
+    const Symbol &symbol(const uintptr_t address) const {
+        const auto entry = _symbols.find(address);
+        assert(entry != _symbols.end());
+
+        return entry->second;
+    }
+
+    const std::string &name(const uintptr_t address) const {
+        return symbol(address).description;
+    }
+private:
+    std::unordered_map<uintptr_t, Symbol> _symbols;
 };
 
 #endif /* UTIL_H */